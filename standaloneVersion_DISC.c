@@ -1,7 +1,12 @@
+#define _CRT_RAND_S // necessario per rand_s ( generatore casuale crittografico di Windows )
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <time.h>
+#include <winsock2.h>   // deve precedere windows.h
+#include <afunix.h>     // socket Unix locali ( Windows 10 1803 o successivo ), usati dal daemon
 #include <windows.h>
 
 #include <pcap.h>
@@ -35,12 +40,11 @@ typedef struct availableInterlocutorsList {
 
 
 mac_address ssapAddress;                                        // indirizzo MAC del SSAP ( il mio indirizzo MAC )
-mac_address dsap_address;                                       // indirizzo MAC del DSAP ( il MAC della scheda di rete del destinatario )
+mac_address dsapAddress;                                        // indirizzo MAC del DSAP ( il MAC della scheda di rete del destinatario )
 availableInterlocutorsList *availableInterlocutorsHead = NULL;  // lista dei dispositivi che hanno inviato RTCS
 availableInterlocutor myInterlocutor;                           // interlocutore scelto dall'utente
-
-char *encryptionKey;    // chiave di criptazione
-char *encryptionSalt;   // sale di criptazione
+char displayName[51] = "";                                      // nome con cui gli altri dispositivi mi visualizzano
+char mainNicName[200] = "";                                     // nome della NIC scelta, per aprirla di nuovo con un timeout diverso
 
 typedef enum boolean {
     FALSE = 0,
@@ -49,18 +53,555 @@ typedef enum boolean {
 
 
 
+#define PEER_POOL_LEN 256           // quanti dispositivi disponibili vengono ricordati al massimo ( poi vengono riusati i più vecchi )
+#define MESSAGE_ARENA_LEN 65536     // byte dell'arena circolare da cui vengono presi i buffer dei messaggi ricevuti
+
+availableInterlocutorsList availableInterlocutorsStorage[PEER_POOL_LEN];                   // elementi della lista dei dispositivi disponibili
+availableInterlocutorsList *availableInterlocutorsPool = availableInterlocutorsStorage;     // pool in uso ( il simulatore ne dà uno piccolo ad ogni dispositivo )
+int availableInterlocutorsPoolLen = PEER_POOL_LEN;
+int availableInterlocutorsCount = 0;                                                        // elementi del pool già usati
+char messageArena[MESSAGE_ARENA_LEN];                                   // usata solo dal thread che riceve i messaggi della sessione
+int messageArenaHead = 0;
+
+
+
+#define ADMISSION_SOURCES 1024      // quanti mittenti vengono seguiti al massimo dal controllo di ammissione ( potenza di 2 )
+#define ADMISSION_PROBES 8          // in quante posizioni consecutive della tabella viene cercato un mittente
+#define ADMISSION_CLASSES 2
+
+typedef enum admissionClass {
+    ADMISSION_DISCOVERY = 0,    // RTCS e richieste di entrare in un gruppo
+    ADMISSION_MESSAGE = 1       // messaggi di gruppo di chi non è un membro riconosciuto ( l'interlocutore ed i membri non sono limitati )
+} admissionClass;
+
+typedef struct tokenBucket {
+    double tokens;                      // pacchetti che il mittente può ancora inviare subito
+    unsigned long long lastRefill;      // istante ( in microsecondi, dall'header pcap ) dell'ultima ricarica
+} tokenBucket;
+
+typedef struct admissionSource {
+    boolean used;
+    mac_address address;
+    unsigned long long lastSeen;        // per scegliere quale mittente dimenticare quando la tabella è piena
+    tokenBucket buckets[ADMISSION_CLASSES];
+} admissionSource;
+
+const double admissionRates[ADMISSION_CLASSES] = { 2 , 10000 };            // pacchetti al secondo ammessi per ogni mittente
+const double admissionBursts[ADMISSION_CLASSES] = { 5 , 1000 };             // pacchetti ammessi di fila dopo un periodo di silenzio
+const double admissionTotalRates[ADMISSION_CLASSES] = { 200 , 20000 };      // pacchetti al secondo ammessi sommando tutti i mittenti
+const double admissionTotalBursts[ADMISSION_CLASSES] = { 200 , 2000 };
+
+admissionSource admissionSources[ADMISSION_SOURCES];
+tokenBucket admissionTotal[ADMISSION_CLASSES];  // un flood da MAC sempre diversi supera i secchi dei mittenti, non questo
+boolean admissionTotalStarted = FALSE;
+unsigned long long admissionAccepted[ADMISSION_CLASSES];
+unsigned long long admissionShed[ADMISSION_CLASSES];
+unsigned long long admissionTotalShed[ADMISSION_CLASSES];   // pacchetti scartati solo per il limite complessivo
+CRITICAL_SECTION admissionLock;     // la tabella è usata sia dal thread della sessione che da quello del gruppo
+unsigned long long shedMessagesReported = 0;    // messaggi scartati già comunicati all'utente
+DWORD shedReportTick = 0;                       // istante dell'ultima comunicazione ( al massimo una al secondo )
+
+
+
+#define ENCRYPTION_KEY_LEN 32       // la chiave di criptazione è lunga 32 caratteri
+#define ENCRYPTION_SALT_LEN 5       // il sale di criptazione è lungo 5 caratteri
+
+#define REKEY_BYTES_TRIGGER 65536   // dopo quanti byte criptati con la stessa chiave viene avviato il cambio di chiave
+#define REKEY_TIME_TRIGGER 300000   // dopo quanti millisecondi con la stessa chiave viene avviato il cambio di chiave ( 5 minuti )
+#define REKEY_CONFIRMATION "DISCREKY" // testo noto con cui l'interlocutore conferma di possedere la nuova chiave
+#define ENCRYPTION_KEY_ALPHABET "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+#define ENCRYPTION_SALT_ALPHABET "[{]}!@#$^&*()_+-=,./<>?;':|"
+
+#define KEY_NUMBER_LEN 16                           // i numeri dello scambio di chiavi sono lunghi 16 byte ( 127 bit )
+#define KEY_NUMBER_PRIME_HIGH 0x7fffffffffffffffULL // primo sicuro 2^127 - 2721: anche ( p-1 ) / 2 è primo
+#define KEY_NUMBER_PRIME_LOW 0xfffffffffffff55fULL
+#define KEY_NUMBER_ORDER_HIGH 0x3fffffffffffffffULL // ( p-1 ) / 2, ordine del sottogruppo generato da KEY_NUMBER_GENERATOR
+#define KEY_NUMBER_ORDER_LOW 0xfffffffffffffaafULL
+#define KEY_NUMBER_GENERATOR 4
+
+typedef struct keyNumber {
+    unsigned long long high;
+    unsigned long long low;
+} keyNumber;
+
+typedef struct encryptionContext {
+    char key[ENCRYPTION_KEY_LEN+1];
+    char salt[ENCRYPTION_SALT_LEN+1];
+    u_char epoch;                   // numero della chiave, viaggia in chiaro in ogni messaggio
+} encryptionContext;
+
+encryptionContext currentEncryption;    // chiave usata per criptare i messaggi in uscita
+encryptionContext previousEncryption;   // chiave precedente, tenuta per i messaggi ancora in viaggio durante un cambio di chiave
+encryptionContext pendingEncryption;    // chiave proposta all'interlocutore e non ancora confermata
+boolean rekeyPending = FALSE;           // indica se è in corso un cambio di chiave
+boolean rekeyInitiator = FALSE;         // solo il cMaster avvia i cambi di chiave, così le proposte non si incrociano
+unsigned long bytesSinceRekey = 0;      // byte criptati con la chiave corrente
+clock_t lastRekeyClock;                 // istante in cui la chiave corrente è entrata in uso
+CRITICAL_SECTION encryptionLock;        // protegge le chiavi, usate sia dal thread della chat che da quello di ricezione
+
+
+
+#define KEEPALIVE_IDLE_INTERVAL 5000    // dopo quanti millisecondi senza pacchetti dall'interlocutore viene inviato un ping
+#define KEEPALIVE_CHECK_INTERVAL 100    // ogni quanti millisecondi viene controllato lo stato della connessione
+#define KEEPALIVE_MAX_MISSED 3          // dopo quanti ping consecutivi senza risposta l'interlocutore è considerato perso
+#define RTO_INITIAL 1000                // timeout di ritrasmissione prima della prima misura del RTT ( millisecondi )
+#define RTO_MIN 200                     // limiti del timeout di ritrasmissione ( millisecondi )
+#define RTO_MAX 10000
+#define MESSAGE_TIMESTAMPS_OFFSET 492   // nei messaggi gli ultimi 8 byte contengono il timestamp e l'eco del timestamp dell'interlocutore
+
+typedef struct keepaliveState {
+    DWORD lastHeardTick;            // ultimo pacchetto ricevuto dall'interlocutore ( GetTickCount )
+    DWORD pingTick;                 // ultimo ping inviato
+    boolean pingOutstanding;        // indica se l'ultimo ping è ancora senza risposta
+    int missedPongs;                // ping consecutivi rimasti senza risposta
+    DWORD peerTimestamp;            // ultimo timestamp dell'interlocutore, da restituire nell'eco ( 0 se già restituito )
+    DWORD peerTimestampTick;        // istante in cui è arrivato, per togliere dall'eco il tempo di attesa
+    boolean rttMeasured;
+    double smoothedRtt;             // millisecondi ( stima come in RFC 6298 )
+    double rttVariation;            // millisecondi, è anche la stima del jitter
+    double retransmitTimeout;       // millisecondi
+    unsigned long long rttSamples;
+} keepaliveState;
+
+keepaliveState keepalive;
+CRITICAL_SECTION keepaliveLock;     // lo stato è aggiornato dal thread di ricezione e letto da quello della chat
+pcap_t *sessionHandle = NULL;       // NIC della sessione ( NULL se non c'è una sessione ), usata anche per inviare la chiusura quando il programma termina
+boolean daemonMode = FALSE;         // indica se il programma è controllato attraverso il socket invece che dalla console
+
+
+
+#define TRANSMIT_CLASSES 3          // numero di classi di priorità dei pacchetti in uscita
+#define TRANSMIT_QUEUE_LEN 256      // quanti pacchetti può contenere la coda di ogni classe
+#define TRANSMIT_PACKET_LEN 1514    // dimensione massima di un pacchetto Ethernet ( senza FCS )
+#define TRANSMIT_BURST 8            // quanti pacchetti della stessa classe vengono inviati con una chiamata al driver prima di ricontrollare le code
+
+typedef enum transmitClass {
+    TRANSMIT_CONTROL = 0,       // chiusura, chiavi, conferme: non devono mai attendere
+    TRANSMIT_INTERACTIVE = 1,   // messaggi scritti dall'utente
+    TRANSMIT_BULK = 2           // blocchi dei file
+} transmitClass;
+
+typedef struct queuedPacket {
+    pcap_t *nicHandle;
+    int packetLength;
+    LARGE_INTEGER enqueueTime;  // istante in cui il pacchetto è stato accodato
+    u_char packet[TRANSMIT_PACKET_LEN];
+} queuedPacket;
+
+typedef struct transmitQueue {
+    queuedPacket *slots;        // coda circolare di TRANSMIT_QUEUE_LEN pacchetti
+    int head;
+    int count;
+    int sending;                // pacchetti in testa alla coda che lo scheduler sta inviando
+    int maxDepth;               // statistiche: profondità massima raggiunta
+    unsigned long long sentPackets;
+    unsigned long long droppedPackets;  // pacchetti scartati perché la coda era piena ( solo da chi non può attendere )
+    double totalWait;           // statistiche: secondi di attesa totali e massimi in coda
+    double maxWait;
+    unsigned long long transmitBytes;   // byte passati al driver e secondi spesi a passarglieli ( per misurare la capacità della NIC )
+    double transmitSeconds;
+} transmitQueue;
+
+transmitQueue transmitQueues[TRANSMIT_CLASSES];
+CRITICAL_SECTION transmitLock;          // protegge le code di invio
+CONDITION_VARIABLE transmitNotEmpty;    // segnala allo scheduler che c'è un pacchetto da inviare
+CONDITION_VARIABLE transmitNotFull;     // segnala a chi accoda che si è liberato un posto
+CONDITION_VARIABLE transmitDrained;     // segnala che lo scheduler ha inviato dei pacchetti
+pcap_send_queue *bulkSendQueue;         // raffica di pacchetti che lo scheduler sta inviando
+
+
+
+#define RELAY_READ_TIMEOUT 1                 // timeout di lettura delle NIC del relay in millisecondi ( latenza massima di inoltro )
+#define RELAY_KERNEL_BUFFER ( 8*1024*1024 )   // byte del buffer del driver per ogni NIC del relay
+#define RELAY_QUEUE_FRAMES 256                // quanti pacchetti vengono inoltrati con una sola chiamata al driver
+#define RELAY_RECENT_FRAMES 4096              // posizioni della tabella dei pacchetti inoltrati di recente ( potenza di 2 )
+#define RELAY_DUPLICATE_WINDOW 100            // per quanti millisecondi un pacchetto uguale ad uno già inoltrato viene scartato ( meno di RTO_MIN )
+#define RELAY_STATIONS 1024                   // quanti dispositivi vengono ricordati con il lato da cui trasmettono ( potenza di 2 )
+#define RELAY_STATION_PROBES 8                // in quante posizioni consecutive della tabella viene cercato un dispositivo
+#define RELAY_STATION_AGE 1000                // dopo quanti millisecondi di silenzio un dispositivo può comparire dall'altro lato
+
+typedef struct relayDirection {
+    const char *name;
+    int side;                               // lato da cui la direzione legge ( 0 o 1 )
+    pcap_t *inputHandle;
+    pcap_t *outputHandle;
+    pcap_send_queue *sendQueue;             // pacchetti letti con l'ultima chiamata al driver, da inoltrare insieme
+    unsigned long long forwardedFrames;
+    unsigned long long duplicateFrames;     // pacchetti già inoltrati ( anelli tra più relay o pacchetti inviati da me e ricatturati )
+    unsigned long long limitedFrames;       // RTCS e richieste di gruppo oltre il limite del mittente
+    unsigned long long reflectedFrames;     // pacchetti di dispositivi che trasmettono dall'altro lato ( inoltrati da me o da un altro relay )
+    unsigned long long droppedFrames;       // pacchetti che non è stato possibile accodare per l'inoltro
+} relayDirection;
+
+typedef struct relayStation {
+    boolean used;
+    mac_address address;
+    int side;                               // lato da cui il dispositivo ha trasmesso l'ultima volta
+    DWORD tick;                             // istante dell'ultimo pacchetto ( GetTickCount )
+} relayStation;
+
+typedef struct recentFrame {
+    unsigned long long hash;
+    DWORD tick;                             // istante dell'inoltro ( GetTickCount )
+} recentFrame;
+
+relayDirection relayDirections[2];
+recentFrame relayRecentFrames[RELAY_RECENT_FRAMES];
+relayStation relayStations[RELAY_STATIONS];
+CRITICAL_SECTION relayLock;                 // le tabelle sono condivise dalle due direzioni
+
+
+
+#define DAEMON_MESSAGE_LEN ( MESSAGE_TIMESTAMPS_OFFSET - 18 )   // lunghezza massima di un messaggio
+#define DAEMON_INBOX_LEN 4096           // quanti messaggi ricevuti restano in attesa dei client ( poi si perdono i più vecchi )
+#define DAEMON_BATCH_MAX 1024           // quanti messaggi al massimo in una richiesta o in una risposta
+#define DAEMON_BUFFER_LEN ( 16 + DAEMON_BATCH_MAX * ( 2 + DAEMON_MESSAGE_LEN ) ) // dimensione massima di una richiesta o di una risposta
+#define DAEMON_BEACON_INTERVAL 1000     // ogni quanti millisecondi il daemon senza sessione ripete la RTCS
+#define DAEMON_KEY_TIMEOUT 10000        // per quanti millisecondi dopo una STCS si attende la chiave ( come receive_encryptionKey )
+
+typedef enum daemonCommand {
+    DAEMON_LIST = 1,        // elenco dei dispositivi disponibili
+    DAEMON_OPEN = 2,        // apre una sessione con un dispositivo ( come cMaster )
+    DAEMON_SEND = 3,        // invia un gruppo di messaggi
+    DAEMON_RECEIVE = 4,     // restituisce i messaggi ricevuti ( senza attendere )
+    DAEMON_CLOSE = 5,       // chiude la sessione
+    DAEMON_STATUS = 6       // stato della sessione
+} daemonCommand;
+
+typedef enum daemonStatus {
+    DAEMON_OK = 0,
+    DAEMON_BAD_REQUEST = 1,
+    DAEMON_NO_SESSION = 2,
+    DAEMON_SESSION_OPEN = 3
+} daemonStatus;
+
+typedef struct daemonMessage {
+    u_short length;
+    char text[DAEMON_MESSAGE_LEN];
+} daemonMessage;
+
+typedef struct daemonState {
+    pcap_t *nicHandle;
+    char socketPath[108];               // percorso del socket Unix
+    boolean waitingKey;                 // il daemon è stato scelto da un cMaster ed attende la chiave
+    boolean connecting;                 // il daemon sta inviando STCS e chiave all'interlocutore scelto ( fuori da daemonLock )
+    DWORD waitingKeyDeadline;           // istante ( GetTickCount ) oltre il quale la chiave non è più attesa
+    daemonMessage inbox[DAEMON_INBOX_LEN];  // coda circolare dei messaggi ricevuti
+    int inboxHead;
+    int inboxCount;
+    unsigned long long droppedMessages; // messaggi persi perché nessun client li ha letti in tempo
+} daemonState;
+
+daemonState daemonSession;
+CRITICAL_SECTION daemonLock;            // protegge la coda dei messaggi, la lista dei dispositivi e l'apertura delle sessioni
+
+typedef struct daemonBenchmarkReceiver {
+    char *socketPath;
+    int messagesCount;          // messaggi attesi
+    int batchSize;              // messaggi chiesti al massimo con ogni richiesta
+    int receivedMessages;
+    int requests;
+    int emptyRequests;          // richieste a cui il daemon ha risposto senza messaggi
+    unsigned long droppedMessages;  // messaggi persi dal daemon perché la coda era piena
+    double seconds;             // dall'avvio al messaggio più recente
+} daemonBenchmarkReceiver;
+
+
+
+#define TERMINAL_SCROLLBACK_LEN 2048    // righe conservate nella cronologia
+#define TERMINAL_LINE_LEN 600           // lunghezza massima di una riga ( nome + messaggio )
+#define TERMINAL_INPUT_LEN 1000         // lunghezza massima della riga di input
+#define TERMINAL_FRAME_INTERVAL 33      // millisecondi tra due disegni ( circa 30 al secondo )
+#define TERMINAL_FRAME_LEN ( TERMINAL_SCROLLBACK_LEN * ( TERMINAL_LINE_LEN + 2 ) + TERMINAL_INPUT_LEN + 256 ) // dimensione massima di un disegno
+
+typedef struct terminalState {
+    volatile boolean active;            // indica se l'interfaccia è avviata ( altrimenti si stampa direttamente ), letto senza lock dal thread di disegno
+    boolean console;                    // stdout è una console che accetta le sequenze VT ( altrimenti è rediretto )
+    boolean keyboard;                   // stdin è la tastiera della console ( altrimenti si legge con fgets )
+    HANDLE outputHandle;
+    HANDLE inputHandle;
+    DWORD inputMode;                    // modalità della console da ripristinare alla chiusura
+    int rows;                           // dimensioni della finestra: l'ultima riga è quella di input
+    int columns;
+    char lines[TERMINAL_SCROLLBACK_LEN][TERMINAL_LINE_LEN]; // cronologia circolare ( la riga n sta in lines[n % TERMINAL_SCROLLBACK_LEN] )
+    unsigned long long linesWritten;    // righe aggiunte in totale
+    unsigned long long linesShown;      // righe già disegnate
+    unsigned long long viewEnd;         // fine della parte di cronologia mostrata ( 0 = segue i nuovi messaggi )
+    unsigned long long shownNewLines;   // righe sotto la parte mostrata, indicate nel prompt mentre si guarda la cronologia
+    boolean fullRedraw;                 // ridisegnare tutta la finestra ( avvio, ridimensionamento, cronologia )
+    char input[TERMINAL_INPUT_LEN];
+    int inputLength;
+    boolean inputChanged;
+    unsigned long long frames;          // statistiche del disegno
+    unsigned long long linesDrawn;
+    unsigned long long linesSkipped;    // righe arrivate in un'unica raffica più alta della finestra ( restano nella cronologia )
+    unsigned long long linesLost;       // righe uscite dalla cronologia prima di essere disegnate
+    unsigned long long bytesWritten;
+    unsigned long long writerWaits;     // volte in cui chi scrive ha atteso il thread di disegno ( output rediretto con la cronologia piena )
+    double maxFrameTime;                // millisecondi
+} terminalState;
+
+terminalState terminal;
+CRITICAL_SECTION terminalLock;          // protegge la cronologia e la riga di input, brevemente: chi riceve non aspetta mai la console
+CRITICAL_SECTION terminalDrawLock;      // un solo disegno alla volta ( thread di disegno e chiusura )
+CONDITION_VARIABLE terminalBacklog;     // sveglia il thread di disegno prima del tempo quando l'output rediretto è indietro
+CONDITION_VARIABLE terminalNotFull;     // segnala a chi scrive che il thread di disegno ha liberato la cronologia
+char *terminalFrame = NULL;             // buffer in cui viene preparato ogni disegno
+
+
+
+#define REPLAY_FRAME_INTERVAL 10    // microsecondi tra un pacchetto e l'altro nei file pcap generati ( se non è richiesto un ritmo di messaggi )
+#define REPLAY_BEACON_INTERVAL 50   // ogni quanti pacchetti dell'applicazione i file pcap generati contengono una RTCS
+#define REPLAY_FAKE_HOSTS 16        // quanti dispositivi diversi inviano RTCS nei file pcap generati
+
+boolean replayMode = FALSE;         // indica se i pacchetti arrivano da un file pcap: in questo caso non viene inviato nulla
+boolean simulationMode = FALSE;     // indica se i pacchetti arrivano dal simulatore: i messaggi vengono contati invece che stampati
+
+
+
+#define SIM_FRAME_LEN 80                // byte significativi di un pacchetto simulato ( il resto dei 500 byte è vuoto )
+#define SIM_MIN_WIRE_LEN 60             // lunghezza minima di un pacchetto Ethernet: i pacchetti più corti occupano il segmento come questo
+#define SIM_MAX_PEERS 65536             // l'indice del dispositivo simulato occupa gli ultimi due byte del MAC
+#define SIM_CANDIDATES 8                // quanti cSlave ricorda un cMaster durante la ricerca
+#define SIM_BEACON_INTERVAL 1000000     // ogni quanti microsecondi un cSlave libero ripete la RTCS
+#define SIM_DISCOVERY_WINDOW 2000000    // per quanti microsecondi un cMaster ascolta le RTCS prima di scegliere
+#define SIM_MESSAGE_INTERVAL 1000000    // ogni quanti microsecondi ( in media ) un dispositivo in sessione invia un messaggio
+#define SIM_SESSION_LENGTH 30000000     // dopo quanti microsecondi il cMaster chiude la sessione
+#define SIM_SESSION_TIMEOUT 5000000     // dopo quanti microsecondi di silenzio l'interlocutore è considerato perso
+
+typedef enum simPeerState {
+    SIM_BEACONING,      // cSlave libero: ripete la RTCS
+    SIM_WAITING_KEY,    // cSlave scelto: attende la chiave
+    SIM_DISCOVERING,    // cMaster libero: ascolta le RTCS
+    SIM_CONNECTING,     // cMaster che ha inviato STCS e chiave: attende il primo messaggio
+    SIM_CHATTING        // sessione stabilita
+} simPeerState;
+
+typedef struct sessionContext {
+    mac_address ssapAddress;
+    mac_address dsapAddress;
+    availableInterlocutor myInterlocutor;
+    availableInterlocutorsList *availableInterlocutorsHead;
+    availableInterlocutorsList *availableInterlocutorsPool;
+    int availableInterlocutorsPoolLen;
+    int availableInterlocutorsCount;
+    encryptionContext currentEncryption;
+    encryptionContext previousEncryption;
+    encryptionContext pendingEncryption;
+    boolean rekeyPending;
+    boolean rekeyInitiator;
+    unsigned long bytesSinceRekey;
+    clock_t lastRekeyClock;
+} sessionContext; // stato della sessione di un dispositivo simulato, messo nelle variabili globali mentre riceve un pacchetto
+
+typedef struct simPeer {
+    boolean isMaster;
+    simPeerState state;
+    int partner;                            // indice dell'interlocutore ( -1 se non c'è )
+    int timerGeneration;                    // i timer con un numero diverso sono stati annullati
+    int discoveringSlot;                    // posizione nella lista dei cMaster in ricerca ( -1 se non c'è )
+    unsigned long long stateSince;          // istante virtuale di ingresso nello stato corrente
+    unsigned long long discoveryStart;      // istante virtuale in cui il cMaster ha iniziato a cercare
+    unsigned long long lastHeard;           // ultimo pacchetto ricevuto dall'interlocutore
+    unsigned int messageCounter;
+    sessionContext session;                 // indirizzi, cSlave sentiti durante la ricerca e chiavi, usati dalle funzioni di ricezione reali
+    availableInterlocutorsList candidatesPool[SIM_CANDIDATES];  // pool dei cSlave sentiti ( vengono ricordati solo gli ultimi )
+} simPeer;
+
+typedef struct simEvent {
+    unsigned long long time;                // istante virtuale in microsecondi
+    unsigned long long sequence;            // a parità di istante gli eventi vengono eseguiti in ordine di creazione
+    int peerIndex;                          // destinatario ( -1 per i pacchetti broadcast )
+    int timerGeneration;
+    int frameLength;                        // 0 per i timer
+    u_char frame[SIM_FRAME_LEN];
+} simEvent;
+
+typedef struct simulatorState {
+    simPeer *peers;
+    int peersCount;
+    int *discovering;                       // cMaster in ricerca, gli unici che ascoltano le RTCS
+    int discoveringCount;
+    simEvent *events;                       // heap ordinato per istante e numero di sequenza
+    int eventsCount;
+    int eventsCapacity;
+    unsigned long long sequence;
+    unsigned long long now;
+    unsigned long long randomState;         // stato del generatore pseudocasuale ( stesso seme, stessa simulazione )
+
+    // caratteristiche del segmento virtuale
+    double lossPercent;
+    double duplicatePercent;
+    double reorderPercent;                  // pacchetti che subiscono un ritardo aggiuntivo e vengono superati dai successivi
+    unsigned long long latency;             // microsecondi
+    unsigned long long reorderDelay;        // ritardo aggiuntivo massimo dei pacchetti riordinati, in microsecondi
+    double bitsPerMicrosecond;              // banda del segmento ( condiviso da tutti )
+    unsigned long long busyUntil;           // istante in cui il segmento torna libero
+
+    // statistiche
+    unsigned long long eventsProcessed;
+    unsigned long long framesSent , framesDelivered , framesLost , framesDuplicated;
+    unsigned long long sessionsEstablished , sessionsClosed , collisions , peersLost;
+    unsigned long long messagesSent , messagesDelivered , decryptionFailures;
+    unsigned long long handshakeTotal , handshakeMax;
+} simulatorState;
+
+simulatorState simulator;
+
+
+
+#define FILE_CHUNK_LEN ( ENCRYPTION_KEY_LEN * ENCRYPTION_SALT_LEN * 8 ) // 1280 byte: ogni blocco inizia all'inizio di chiave e sale, quindi i blocchi si criptano indipendentemente
+#define FILE_PACKET_LEN ( 25 + FILE_CHUNK_LEN )                         // header Ethernet + tipo + offset + lunghezza + blocco
+#define FILE_WINDOW_CHUNKS 64       // quanti blocchi vengono inviati prima di attendere una conferma
+#define FILE_WORKERS 4              // quanti thread criptano i blocchi in parallelo
+#define FILE_NAME_LEN 200           // lunghezza massima del nome di un file
+#define FILE_DOWNLOAD_DIR "DISC downloads"  // cartella in cui vengono salvati i file ricevuti ( mai sovrascritti )
+#define FILE_PATH_LEN ( sizeof(FILE_DOWNLOAD_DIR) + FILE_NAME_LEN + 6 ) // cartella + \ + nome + .part
+#define FILE_MAX_SIZE ( 4ULL*1024*1024*1024 )   // dimensione massima di un file ricevuto ( 4 GB )
+#define FILE_FREE_SPACE_MARGIN ( 256ULL*1024*1024 ) // spazio che deve restare libero sul disco dopo la ricezione
+#define FILE_ACK_INTERVAL 200       // ogni quanti millisecondi al massimo il destinatario ripete una conferma
+#define FILE_MAX_RETRIES 10         // dopo quanti reinvii senza progressi il trasferimento viene interrotto
+#define FILE_RECEIVE_TIMEOUT 10000  // dopo quanti millisecondi senza blocchi il destinatario considera il trasferimento interrotto
+
+typedef struct fileTransferBatch {
+    const u_char *fileData;         // file mappato in memoria
+    unsigned long long fileSize;
+    unsigned long long firstOffset; // offset del primo blocco del gruppo
+    int chunksCount;                // quanti blocchi ci sono nel gruppo
+    u_char *packets;                // pacchetti del gruppo, uno ogni FILE_PACKET_LEN byte
+    encryptionContext encryption;
+} fileTransferBatch;
+
+fileTransferBatch fileBatch;                    // gruppo di blocchi che i thread stanno criptando
+HANDLE fileWorkersStartEvents[FILE_WORKERS];    // segnalano ai thread che c'è un nuovo gruppo
+HANDLE fileWorkersDoneEvents[FILE_WORKERS];     // segnalano al thread principale che i thread hanno finito
+
+typedef struct fileReception {
+    boolean active;                 // indica se è in corso la ricezione di un file
+    pcap_t *nicHandle;              // NIC principale, su cui viaggiano le conferme
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+    char fileName[FILE_NAME_LEN+1];
+    u_char *fileData;               // file di destinazione mappato in memoria
+    unsigned long long fileSize;
+    unsigned long long expectedOffset;  // i byte prima di questo offset sono stati ricevuti tutti
+    unsigned long long receivedMask;    // blocchi già ricevuti dopo quello atteso ( bit i = blocco expectedOffset + i*FILE_CHUNK_LEN )
+    unsigned long long acknowledgedOffset;  // offset dell'ultima conferma inviata: il mittente parte da qui con il gruppo successivo
+    encryptionContext encryption;
+    clock_t lastChunkClock;
+    clock_t lastAcknowledgementClock;
+    char partPath[FILE_PATH_LEN];       // file in cui viene salvato l'offset da cui riprendere
+} fileReception;
+
+fileReception fileReceptionState;   // ricezione in corso, condivisa con i thread delle NIC aggiuntive
+CRITICAL_SECTION receptionLock;     // protegge fileReceptionState e fileAcknowledgedOffset
+
+volatile LONG fileSending = FALSE;              // indica se c'è un file in invio ( uno alla volta )
+char fileSendingPath[1000];                     // percorso del file in invio
+HANDLE fileAcknowledgementEvent;                // segnala al thread che invia il file che è arrivata una conferma
+unsigned long long fileAcknowledgedOffset;      // offset dell'ultima conferma arrivata
+
+
+
+#define STRIPE_MAX_LINKS 4          // quante NIC al massimo può usare una sessione ( compresa quella principale )
+#define STRIPE_READ_TIMEOUT 100     // timeout di lettura delle NIC aggiuntive in millisecondi
+#define STRIPE_HELLO_TIMEOUT 5000   // per quanti millisecondi al massimo si cerca l'interlocutore sulle NIC aggiuntive
+#define STRIPE_INITIAL_CAPACITY 125000000.0 // capacità ipotizzata prima della prima misura ( 1 Gbit/s, in byte al secondo )
+#define STRIPE_MAX_SILENT_WINDOWS 3 // dopo quanti gruppi consecutivi senza blocchi confermati un link che perde blocchi viene escluso
+
+typedef struct stripeLink {
+    pcap_t *nicHandle;
+    mac_address localAddress;       // MAC della mia NIC sul link
+    mac_address peerAddress;        // MAC della NIC dell'interlocutore sul link
+    boolean up;                     // indica se il link è utilizzabile
+    double capacity;                // byte al secondo stimati
+    boolean capacityMeasured;       // la prima misura sostituisce la capacità ipotizzata
+    unsigned long long ackedChunks; // statistiche: blocchi inviati sul link confermati e persi
+    unsigned long long lostChunks;
+    int silentWindows;              // gruppi consecutivi in cui il link ha perso blocchi senza che ne sia stato confermato nessuno
+    pcap_send_queue *sendQueue;     // pacchetti del gruppo assegnati al link
+    unsigned long queuedBytes;
+    HANDLE startEvent;              // segnala al thread del link che la coda è pronta
+    HANDLE doneEvent;               // segnala al thread principale che la coda è stata inviata
+} stripeLink;
+
+stripeLink stripeLinks[STRIPE_MAX_LINKS];   // link della sessione, il primo è la NIC principale
+int stripeLinksCount = 1;
+int sessionLink = 0;                        // link che porta chat, conferme e pacchetti di controllo ( cambia solo se la sua NIC smette di funzionare )
+int stripePacketLinks[FILE_WINDOW_CHUNKS];  // link su cui è partito ogni pacchetto dell'ultimo gruppo
+
+
+
+#define GROUP_MAX_MEMBERS 128       // quanti membri al massimo può avere un gruppo
+#define GROUP_JOIN_TIMEOUT 1000     // dopo quanti millisecondi senza risposta la richiesta di entrare nel gruppo viene ripetuta
+#define GROUP_JOIN_RETRIES 10       // quante volte viene ripetuta la richiesta di entrare nel gruppo
+#define GROUP_READ_TIMEOUT 100      // timeout di lettura della NIC mentre attendo la risposta del proprietario ( millisecondi )
+#define GROUP_PUBLIC_OFFSET 68      // nella richiesta di entrare il valore pubblico segue il nome ( 17 + 51 byte )
+#define GROUP_TAG_LEN 8             // byte delle prove che legano entrate ed uscite al segreto comune
+#define GROUP_LABEL_JOIN 4          // etichette con cui sono ricavate le prove dal segreto comune ( 1-3 sono per la chiave personale )
+#define GROUP_LABEL_LEAVE 5
+#define GROUP_LABEL_OWNER_LEAVE 6
+#define GROUP_KEY_TAG_OFFSET ( 18 + ENCRYPTION_KEY_LEN + ENCRYPTION_SALT_LEN ) // nella chiave di gruppo la prova segue la chiave criptata
+#define GROUP_PREVIOUS_KEY_WINDOW 2000  // per quanti millisecondi dopo un cambio la chiave di gruppo precedente è ancora accettata
+
+typedef struct groupMember {
+    availableInterlocutor interlocutor;
+    encryptionContext memberEncryption;         // chiave personale con cui gli vengono inviate le chiavi di gruppo
+    keyNumber sharedSecret;                     // segreto comune, da cui ricavo la prova che accompagna ogni chiave di gruppo
+    u_char memberPublicValue[KEY_NUMBER_LEN];   // valore pubblico con cui è entrato: una richiesta con un valore diverso non è sua
+    u_char ownerPublicValue[KEY_NUMBER_LEN];    // mio valore pubblico per lui, reinviato se perde la risposta
+    u_char joinTag[GROUP_TAG_LEN];              // prova che conosco il segreto comune, inviata con il mio valore pubblico
+    u_char leaveTag[GROUP_TAG_LEN];             // prova che deve accompagnare la sua uscita
+    u_char ownerLeaveTag[GROUP_TAG_LEN];        // prova con cui gli comunico l'uscita del proprietario
+} groupMember;
+
+unsigned short groupId;                         // numero del gruppo
+mac_address groupAddress;                       // indirizzo multicast del gruppo
+mac_address groupOwnerAddress;                  // MAC del proprietario del gruppo ( che distribuisce le chiavi )
+boolean groupOwner = FALSE;                     // indica se sono il proprietario del gruppo
+char groupName[51];                             // nome con cui gli altri membri mi visualizzano
+groupMember groupMembers[GROUP_MAX_MEMBERS];    // membri del gruppo ( solo per il proprietario )
+int groupMembersCount = 0;
+encryptionContext groupEncryption;              // chiave di gruppo corrente
+encryptionContext previousGroupEncryption;      // chiave di gruppo precedente, per i messaggi ancora in viaggio
+DWORD previousGroupKeyTick;                     // istante del cambio: dopo GROUP_PREVIOUS_KEY_WINDOW la chiave precedente non vale più
+encryptionContext myMemberEncryption;           // mia chiave personale, ricavata dal segreto comune con il proprietario ( solo per i membri )
+keyNumber myGroupExponent;                      // mio esponente segreto dello scambio di chiavi ( solo per i membri )
+keyNumber myGroupSharedSecret;                  // segreto comune con il proprietario, per controllare le chiavi di gruppo ( solo per i membri )
+u_char myGroupPublicValue[KEY_NUMBER_LEN];      // mio valore pubblico, uguale in tutte le richieste di entrare
+u_char myLeaveTag[GROUP_TAG_LEN];               // prova con cui comunico la mia uscita al proprietario
+u_char myOwnerLeaveTag[GROUP_TAG_LEN];          // prova che deve accompagnare l'uscita del proprietario
+CRITICAL_SECTION groupLock;                     // protegge le chiavi di gruppo ed i membri, usati sia dal thread della chat che da quello di ricezione
+boolean groupKeyReceived = FALSE;               // indica se ho ricevuto almeno una chiave di gruppo
+
+
+
 
 
 
 //! === ENCRYPTION SECTION ===
+unsigned int generate_randomNumber () {
+    //. funzione che genera un numero casuale usando il generatore crittografico del sistema
+
+    // a differenza di srand( time(NULL) ) + rand() due chiamate nello stesso secondo non danno lo stesso risultato
+    unsigned int randomNumber;
+    if ( rand_s(&randomNumber) != 0 ) {
+        fprintf( stderr , "Error generating a random number. Restart the program.\n" );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    return randomNumber;
+
+}
+
 void generate_encryptionKey ( char *encryptionKeyStorage , int encryptionKeyLength ) {
     //. funzione che genera una chiave di criptazione
 
-    const char encryptionKeyAlphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-    srand( time(NULL) );
+    const char encryptionKeyAlphabet[] = ENCRYPTION_KEY_ALPHABET;
 
     for ( int i = 0 ; i < encryptionKeyLength ; i++ ) {
-        encryptionKeyStorage[i] = encryptionKeyAlphabet[rand() % ( sizeof(encryptionKeyAlphabet) - 1 )];
+        encryptionKeyStorage[i] = encryptionKeyAlphabet[generate_randomNumber() % ( sizeof(encryptionKeyAlphabet) - 1 )];
     }
 
     encryptionKeyStorage[encryptionKeyLength] = '\0';
@@ -70,14 +611,13 @@ void generate_encryptionKey ( char *encryptionKeyStorage , int encryptionKeyLeng
 void generate_encryptionSalt ( char *encryptionSaltStorage ) {
     //. funzione che genera un sale di criptazione
 
-    const char encryptionSaltAlphabet[] = "[{]}!@#$^&*()_+-=,./<>?;':|";
-    srand( time(NULL) );
+    const char encryptionSaltAlphabet[] = ENCRYPTION_SALT_ALPHABET;
 
-    for ( int i = 0 ; i < 5 ; i++ ) {
-        encryptionSaltStorage[i] = encryptionSaltAlphabet[rand() % ( sizeof(encryptionSaltAlphabet) - 1 )];
+    for ( int i = 0 ; i < ENCRYPTION_SALT_LEN ; i++ ) {
+        encryptionSaltStorage[i] = encryptionSaltAlphabet[generate_randomNumber() % ( sizeof(encryptionSaltAlphabet) - 1 )];
     }
 
-    encryptionSaltStorage[5] = '\0';
+    encryptionSaltStorage[ENCRYPTION_SALT_LEN] = '\0';
 
 }
 
@@ -133,14 +673,216 @@ void decrypt_string ( char *encryptionStorage , char *encryptionKey , char *encr
 
 }
 
+void encrypt_buffer ( char *encryptionStorage , int bufferLength , char *encryptionKey , char *encryptionSalt ) {
+    //. funzione che cripta (o decripta) un buffer di lunghezza nota, anche se contiene byte nulli
+
+    int encryptionKeyLength = strlen( encryptionKey );
+    int encryptionSaltLength = strlen( encryptionSalt );
+
+    int j = 0 , k = 0;
+
+    for ( int i=0 ; i<bufferLength ; i++ ) {
+
+        encryptionStorage[i] = encryptionStorage[i] ^ encryptionKey[j] ^ encryptionSalt[k];
+
+        j++; k++;
+
+        if ( j == encryptionKeyLength )
+            j = 0;
+        if ( k == encryptionSaltLength )
+            k = 0;
+
+    }
+
+}
+
+
+
+int compare_keyNumbers ( keyNumber a , keyNumber b ) {
+    //. funzione che confronta due numeri dello scambio di chiavi ( -1 , 0 o 1 )
+
+    if ( a.high != b.high )
+        return ( a.high < b.high ) ? -1 : 1;
+    if ( a.low != b.low )
+        return ( a.low < b.low ) ? -1 : 1;
+
+    return 0;
+
+}
+
+keyNumber add_keyNumbers ( keyNumber a , keyNumber b ) {
+    //. funzione che somma due numeri modulo il primo dello scambio di chiavi ( entrambi devono essere minori del primo )
+
+    const keyNumber prime = { KEY_NUMBER_PRIME_HIGH , KEY_NUMBER_PRIME_LOW };
+
+    // il primo è minore di 2^127, quindi la somma sta in 128 bit
+    keyNumber sum;
+    sum.low = a.low + b.low;
+    sum.high = a.high + b.high + ( sum.low < a.low );
+
+    if ( compare_keyNumbers( sum , prime ) >= 0 ) {
+        unsigned long long borrow = ( sum.low < prime.low );
+        sum.low -= prime.low;
+        sum.high -= prime.high + borrow;
+    }
+
+    return sum;
+
+}
+
+keyNumber multiply_keyNumbers ( keyNumber a , keyNumber b ) {
+    //. funzione che moltiplica due numeri modulo il primo dello scambio di chiavi
+
+    // raddoppio e sommo un bit alla volta, così non servono interi a 256 bit
+    keyNumber product = { 0 , 0 };
+
+    for ( int bit=127 ; bit>=0 ; bit-- ) {
+        product = add_keyNumbers( product , product );
+        unsigned long long word = ( bit >= 64 ) ? b.high : b.low;
+        if ( ( word >> ( bit % 64 ) ) & 1 )
+            product = add_keyNumbers( product , a );
+    }
+
+    return product;
+
+}
+
+keyNumber power_keyNumber ( keyNumber base , keyNumber exponent ) {
+    //. funzione che eleva un numero ad un esponente modulo il primo dello scambio di chiavi
+
+    keyNumber result = { 0 , 1 };
+
+    for ( int bit=127 ; bit>=0 ; bit-- ) {
+        result = multiply_keyNumbers( result , result );
+        unsigned long long word = ( bit >= 64 ) ? exponent.high : exponent.low;
+        if ( ( word >> ( bit % 64 ) ) & 1 )
+            result = multiply_keyNumbers( result , base );
+    }
+
+    return result;
+
+}
+
+void write_keyNumber ( u_char *storage , keyNumber number ) {
+    //. funzione che scrive un numero dello scambio di chiavi in KEY_NUMBER_LEN byte ( big-endian )
+
+    for ( int i=0 ; i<8 ; i++ ) {
+        storage[i] = ( number.high >> ( 56 - 8*i ) ) & 0xff;
+        storage[8+i] = ( number.low >> ( 56 - 8*i ) ) & 0xff;
+    }
+
+}
+
+keyNumber read_keyNumber ( const u_char *storage ) {
+    //. funzione che legge un numero dello scambio di chiavi da KEY_NUMBER_LEN byte ( big-endian )
+
+    keyNumber number = { 0 , 0 };
+
+    for ( int i=0 ; i<8 ; i++ ) {
+        number.high = number.high << 8 | storage[i];
+        number.low = number.low << 8 | storage[8+i];
+    }
+
+    return number;
+
+}
+
+keyNumber generate_keyExponent () {
+    //. funzione che genera l'esponente segreto di uno scambio di chiavi ( 126 bit casuali, minore dell'ordine del sottogruppo )
+
+    keyNumber exponent;
+
+    do {
+        exponent.high = ( (unsigned long long) generate_randomNumber() << 32 | generate_randomNumber() ) & 0x3fffffffffffffffULL;
+        exponent.low = (unsigned long long) generate_randomNumber() << 32 | generate_randomNumber();
+    } while ( exponent.high == 0 && exponent.low == 0 );
+
+    return exponent;
+
+}
+
+keyNumber compute_publicKeyNumber ( keyNumber exponent ) {
+    //. funzione che calcola il valore pubblico da inviare all'altro dispositivo
+
+    const keyNumber generator = { 0 , KEY_NUMBER_GENERATOR };
+
+    return power_keyNumber( generator , exponent );
+
+}
+
+boolean check_publicKeyNumber ( keyNumber publicNumber ) {
+    //. funzione che controlla che il valore pubblico ricevuto sia nel sottogruppo ( altrimenti il segreto comune sarebbe prevedibile )
+
+    const keyNumber one = { 0 , 1 };
+    const keyNumber primeMinusOne = { KEY_NUMBER_PRIME_HIGH , KEY_NUMBER_PRIME_LOW - 1 };
+    const keyNumber order = { KEY_NUMBER_ORDER_HIGH , KEY_NUMBER_ORDER_LOW };
+
+    if ( compare_keyNumbers( publicNumber , one ) <= 0 || compare_keyNumbers( publicNumber , primeMinusOne ) >= 0 )
+        return FALSE;
+
+    return compare_keyNumbers( power_keyNumber( publicNumber , order ) , one ) == 0;
+
+}
+
+void derive_keyBytes ( keyNumber sharedSecret , int label , u_char *storage ) {
+    //. funzione che ricava dal segreto comune KEY_NUMBER_LEN byte diversi per ogni etichetta
+
+    // ( etichetta^2 )^segreto: conoscere il risultato di un'etichetta non permette di calcolare le altre senza il segreto
+    const keyNumber base = { 0 , (unsigned long long) label * label };
+
+    write_keyNumber( storage , power_keyNumber( base , sharedSecret ) );
+
+}
+
+void compute_keyTag ( keyNumber sharedSecret , const u_char *data , int dataLength , u_char *tag , int tagLength ) {
+    //. funzione che ricava dal segreto comune una prova legata al contenuto dei dati: senza il segreto non si può produrre per altri dati
+
+    // riduco i dati ad un numero minore del primo ( due hash FNV-1a con semi diversi )
+    unsigned long long firstHash = 14695981039346656037ULL , secondHash = 1099511628211ULL;
+    for ( int i=0 ; i<dataLength ; i++ ) {
+        firstHash = ( firstHash ^ data[i] ) * 1099511628211ULL;
+        secondHash = ( secondHash ^ data[i] ) * 14029467366897019727ULL;
+    }
+    keyNumber base = { firstHash >> 2 , secondHash | 2 };
+
+    // come per le etichette: ( hash^2 )^segreto
+    u_char keyBytes[KEY_NUMBER_LEN];
+    write_keyNumber( keyBytes , power_keyNumber( multiply_keyNumbers( base , base ) , sharedSecret ) );
+    memcpy( tag , keyBytes , tagLength );
+
+}
+
+void derive_encryptionContext ( keyNumber sharedSecret , encryptionContext *context ) {
+    //. funzione che ricava dal segreto comune una chiave ed un sale, senza che debbano viaggiare sulla rete
+
+    const char encryptionKeyAlphabet[] = ENCRYPTION_KEY_ALPHABET;
+    const char encryptionSaltAlphabet[] = ENCRYPTION_SALT_ALPHABET;
+
+    // le etichette 1, 2 e 3 danno i 48 byte da cui sono presi i 32 caratteri della chiave ed i 5 del sale
+    u_char keyBytes[3*KEY_NUMBER_LEN];
+    for ( int i=0 ; i<3 ; i++ )
+        derive_keyBytes( sharedSecret , i+1 , keyBytes+i*KEY_NUMBER_LEN );
+
+    for ( int i=0 ; i<ENCRYPTION_KEY_LEN ; i++ )
+        context->key[i] = encryptionKeyAlphabet[keyBytes[i] % ( sizeof(encryptionKeyAlphabet) - 1 )];
+    context->key[ENCRYPTION_KEY_LEN] = '\0';
+
+    for ( int i=0 ; i<ENCRYPTION_SALT_LEN ; i++ )
+        context->salt[i] = encryptionSaltAlphabet[keyBytes[ENCRYPTION_KEY_LEN+i] % ( sizeof(encryptionSaltAlphabet) - 1 )];
+    context->salt[ENCRYPTION_SALT_LEN] = '\0';
+
+    context->epoch = 0;
+
+}
+
 
 
 
 
 
 //! === ADDRESS SETTING SECTION ===
-void set_ssapAddress ( char *nicName ) {
-    //. funzione che imposta l'indirizzo MAC del SSAP
+void find_nicAddress ( char *nicName , mac_address *nicAddress ) {
+    //. funzione che legge l'indirizzo MAC della NIC specificata
 
     pcap_if_t *nicList;
     char errorBuffer[PCAP_ERRBUF_SIZE+1];
@@ -164,15 +906,22 @@ void set_ssapAddress ( char *nicName ) {
         exit(1);
     }
 
-    // copio l'indirizzo MAC della NIC nella variabile globale ssapAddress
+    // copio l'indirizzo MAC della NIC
     for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        ssapAddress.addressBytes[i] = currentDevice->addresses->addr->sa_data[i];
+        nicAddress->addressBytes[i] = currentDevice->addresses->addr->sa_data[i];
 
     // libero la memoria allocata per la lista delle NIC
     pcap_freealldevs(nicList);
 
 }
 
+void set_ssapAddress ( char *nicName ) {
+    //. funzione che imposta l'indirizzo MAC del SSAP
+
+    find_nicAddress( nicName , &ssapAddress );
+
+}
+
 void set_dsapAddress ( u_char *addressBytes ) {
     //. funzione che imposta l'indirizzo MAC del DSAP
     
@@ -226,6 +975,7 @@ pcap_t *open_NIC ( char *nicName ) {
     pcap_t *nicHandle = pcap_open_live( nicName , 65536 , 1 , 60000 , errorBuffer );
     if ( nicHandle != NULL ) {
         set_ssapAddress(nicName);
+        strncpy( mainNicName , nicName , sizeof(mainNicName)-1 );
         return nicHandle;
     }
 
@@ -266,609 +1016,5712 @@ pcap_t *choose_NIC () {
 
 
 
-//! === RTCS SENDING-RECEIVING SECTION ===
-void broadcast_RTCS ( pcap_t *nicHandle ) {
-    //. funzione che "broadcasta" una RTCS sulla rete locale
+//! === TERMINAL SECTION ===
+void add_terminalLine ( const char *text , int textLength ) {
+    //. funzione che aggiunge una riga alla cronologia ( da chiamare con terminalLock preso )
 
-    u_char packet[500];
-    
-    // setto il DSAP a 0xFF ( il pacchetto deve essere broadcastato )
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i] = 0xff;
+    if ( textLength > TERMINAL_LINE_LEN-1 )
+        textLength = TERMINAL_LINE_LEN-1;
 
-    // setto il SSAP in modo tale che sia uguale al mio MAC
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i-ETHER_ADDR_LEN];
-    
-    // setto l'ethertype a quello usato per identificare l'applicazione
-    packet[12] = 0x7a;
-    packet[13] = 0xbc;
+    // i caratteri di controllo ( ad esempio sequenze di escape inviate dall'interlocutore ) non arrivano alla console
+    char *line = terminal.lines[terminal.linesWritten % TERMINAL_SCROLLBACK_LEN];
+    for ( int i=0 ; i<textLength ; i++ )
+        line[i] = ( (u_char) text[i] < 32 || text[i] == 127 ) ? '?' : text[i];
+    line[textLength] = '\0';
 
-    // setto il primo byte a 0 ( per far riconoscere la RTCS )
-    packet[14] = 0x00;
+    terminal.linesWritten++;
 
-    // faccio scegliere all'utente il nome con cui i PC che ascoltano lo visualizzano
-    char name[51]; // 50 caratteri + 1 per il terminatore
-    printf("Choose a name (long between 10 and 50 characters): ");
-    fgets( name , 51 , stdin );
-    // controllo che il nome sia lungo almeno 10 caratteri e che non sia più lungo di 50 caratteri. Se non lo è, uso un nome di default
-    if ( strlen(name) < 10 || strlen(name) > 50 )
-        strcpy( name , "NoNameDevice\n" );
+}
 
-    // setto il nome ed il terminatore
-    for ( int i=0 ; i<50 ; i++ ) {
-        if ( name[i] == '\n' ) {
-            packet[15+i] = '\0';
-            break;
+int build_terminalFrame ( char *frame ) {
+    //. funzione che prepara in un solo buffer tutto quello che è cambiato dall'ultimo disegno e ne restituisce la lunghezza ( da chiamare con terminalLock preso )
+
+    int frameLength = 0;
+
+    // le righe uscite dalla cronologia prima di essere disegnate sono perse
+    unsigned long long oldestLine = ( terminal.linesWritten > TERMINAL_SCROLLBACK_LEN ) ? terminal.linesWritten - TERMINAL_SCROLLBACK_LEN : 0;
+    if ( terminal.linesShown < oldestLine ) {
+        terminal.linesLost += oldestLine - terminal.linesShown;
+        terminal.linesShown = oldestLine;
+    }
+
+    //. output rediretto: scrivo tutte le righe nuove, senza sequenze di controllo
+    if ( terminal.console == FALSE ) {
+        for ( ; terminal.linesShown < terminal.linesWritten ; terminal.linesShown++ ) {
+            frameLength += sprintf( frame+frameLength , "%s\n" , terminal.lines[terminal.linesShown % TERMINAL_SCROLLBACK_LEN] );
+            terminal.linesDrawn++;
         }
-        packet[15+i] = name[i];
+        return frameLength;
     }
 
-    // invio il pacchetto
-    int sendingResult = pcap_sendpacket( nicHandle , packet , 500 );
-    if ( sendingResult == 0 )
-        return;
 
-    // gestisco l'eventuale errore
-    fprintf( stderr , "\nError sending the packet: %s. Restart the program." , pcap_geterr(nicHandle) );
-    Sleep(10000); // 10 secondi
-    exit(1);
 
-}
+    //. console: le righe 1..rows-1 sono il riquadro dei messaggi ( regione di scorrimento ), l'ultima è la riga di input
+    int paneRows = terminal.rows - 1;
+    boolean following = ( terminal.viewEnd == 0 );
 
-void list_availableInterlocutors ( pcap_t *nicHandle ) {
-    //. funzione che elenca i dispositivi che hanno inviato RTCS
+    if ( terminal.fullRedraw ) {
 
-    int readingResult;
-    packetHeader *header;
-    const u_char *packetData;
-    boolean receivedRTCS = FALSE; // variabile che indica se ho ricevuto almeno una RTCS
+        // ridisegno l'ultima pagina della parte di cronologia guardata
+        unsigned long long lastLine = following ? terminal.linesWritten : terminal.viewEnd;
+        unsigned long long firstLine = ( lastLine > (unsigned long long) paneRows ) ? lastLine - paneRows : 0;
+        if ( firstLine < oldestLine )
+            firstLine = oldestLine;
 
-    // variabili per un timer che interrompa l'ascolto dopo un certo tempo
-    int milliseconds = 0 , trigger = 30000; // 30 secondi
-    clock_t start = clock();
+        frameLength += sprintf( frame+frameLength , "\x1b[1;%dr\x1b[2J\x1b[%d;1H" , paneRows , paneRows );
+        for ( unsigned long long line=firstLine ; line<lastLine ; line++ ) {
+            frameLength += sprintf( frame+frameLength , "\r\n%s" , terminal.lines[line % TERMINAL_SCROLLBACK_LEN] );
+            terminal.linesDrawn++;
+        }
 
-    while ( ((readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0) && (milliseconds<trigger) ) {
-        if ( readingResult == 0 ) { // nessun pacchetto ricevuto
-            printf("Timeout expired. Restart the program.\n");
-            Sleep(10000); // 10 secondi
-            exit(1);
+        if ( following )
+            terminal.linesShown = terminal.linesWritten;
+        terminal.fullRedraw = FALSE;
+        terminal.inputChanged = TRUE;
+
+    }
+    else if ( following && terminal.linesShown < terminal.linesWritten ) {
+
+        // una raffica più alta della finestra: disegno solo l'ultima pagina, il resto resta nella cronologia
+        if ( terminal.linesWritten - terminal.linesShown > (unsigned long long) paneRows ) {
+            terminal.linesSkipped += terminal.linesWritten - terminal.linesShown - paneRows;
+            terminal.linesShown = terminal.linesWritten - paneRows;
         }
 
-        // aggiorno il timer
-        clock_t difference = clock() - start;
-        milliseconds = difference * 1000 / CLOCKS_PER_SEC;
+        // aggiungo le righe nuove in fondo al riquadro, che scorre da solo
+        frameLength += sprintf( frame+frameLength , "\x1b[%d;1H" , paneRows );
+        for ( ; terminal.linesShown < terminal.linesWritten ; terminal.linesShown++ ) {
+            frameLength += sprintf( frame+frameLength , "\r\n%s" , terminal.lines[terminal.linesShown % TERMINAL_SCROLLBACK_LEN] );
+            terminal.linesDrawn++;
+        }
+        terminal.inputChanged = TRUE;
 
+    }
+    else if ( following == FALSE && terminal.linesWritten - terminal.viewEnd != terminal.shownNewLines ) {
 
+        // mentre si guarda la cronologia il prompt indica quante righe ci sono sotto, comprese quelle nuove
+        terminal.inputChanged = TRUE;
 
-        //. controlli sulla validità del pacchetto
-        // controllo che il pacchetto ricevuto sia un RTCS
-        if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x00 )
-            continue;
+    }
 
 
 
-        //. operazioni da eseguire se il pacchetto è valido
-        receivedRTCS = TRUE;
-        // stampo il nome e il MAC del dispositivo che ha broadcastato la RTCS
-        printf( "%s : " , packetData+15 );
-        for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ ) {
-        
-            printf( "%02x" , packetData[i+6] );
-            if ( i != ETHER_ADDR_LEN-1 )
-                printf( ":" );
+    //. riga di input: prompt e fine del testo scritto, se non ci sta tutto
+    if ( terminal.inputChanged ) {
 
+        char prompt[50] = "You : ";
+        if ( following == FALSE ) {
+            terminal.shownNewLines = terminal.linesWritten - terminal.viewEnd;
+            sprintf( prompt , "[%llu more below, PgDn] You : " , terminal.shownNewLines );
         }
-        printf( "\n" );
 
-        // aggiungo il dispositivo alla lista dei dispositivi disponibili ( in testa )
-        availableInterlocutorsList *newInterlocutor = malloc( sizeof(availableInterlocutorsList) );
-        for ( int i=0 ; i<50 ; i++ ) {
+        int visibleLength = terminal.columns - strlen(prompt) - 1;
+        if ( visibleLength < 0 )
+            visibleLength = 0;
+        int inputStart = ( terminal.inputLength > visibleLength ) ? terminal.inputLength - visibleLength : 0;
 
-            if ( packetData[i+15] == '\0' ) {
-                newInterlocutor->interlocutor.name[i] = '\0';
-                break;
-            }
-            newInterlocutor->interlocutor.name[i] = packetData[i+15];
-        
-        }
-        
-        // copio l'indirizzo MAC del dispositivo
-        for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-            newInterlocutor->interlocutor.address.addressBytes[i] = packetData[i+ETHER_ADDR_LEN];
-        
-        // aggiorno la lista
-        newInterlocutor->next = availableInterlocutorsHead;
-        availableInterlocutorsHead = newInterlocutor;
+        frameLength += sprintf( frame+frameLength , "\x1b[%d;1H\x1b[2K%s%.*s" , terminal.rows , prompt ,
+                                terminal.inputLength - inputStart , terminal.input + inputStart );
+        terminal.inputChanged = FALSE;
 
     }
 
-    if ( receivedRTCS == FALSE ) {
-        printf("No RTCS has been received. Restart the program.\n");
-        Sleep(10000); // 10 secondi
-        exit(1);
+    return frameLength;
+
+}
+
+void draw_terminalFrame () {
+    //. funzione che disegna quanto è cambiato con una sola scrittura sulla console
+
+    EnterCriticalSection( &terminalDrawLock );
+
+    // le dimensioni della finestra possono cambiare in qualsiasi momento
+    CONSOLE_SCREEN_BUFFER_INFO screenInfo;
+    int rows = 25 , columns = 80;
+    if ( terminal.console && GetConsoleScreenBufferInfo( terminal.outputHandle , &screenInfo ) ) {
+        rows = screenInfo.srWindow.Bottom - screenInfo.srWindow.Top + 1;
+        columns = screenInfo.srWindow.Right - screenInfo.srWindow.Left + 1;
+    }
+    if ( rows < 2 )
+        rows = 2;
+
+    LARGE_INTEGER frameStart , frameEnd , frequency;
+    QueryPerformanceCounter( &frameStart );
+
+    // preparo il disegno tenendo la cronologia solo per il tempo necessario
+    EnterCriticalSection( &terminalLock );
+    if ( rows != terminal.rows || columns != terminal.columns ) {
+        terminal.rows = rows;
+        terminal.columns = columns;
+        terminal.fullRedraw = TRUE;
     }
+    int frameLength = build_terminalFrame( terminalFrame );
+    LeaveCriticalSection( &terminalLock );
+    WakeAllConditionVariable( &terminalNotFull );
+
+    // una sola scrittura per disegno, qualunque sia il numero di messaggi arrivati
+    if ( frameLength > 0 ) {
+        DWORD writtenBytes;
+        WriteFile( terminal.outputHandle , terminalFrame , frameLength , &writtenBytes , NULL );
+
+        QueryPerformanceCounter( &frameEnd );
+        QueryPerformanceFrequency( &frequency );
+        double frameTime = (double) ( frameEnd.QuadPart - frameStart.QuadPart ) * 1000 / frequency.QuadPart;
+        terminal.frames++;
+        terminal.bytesWritten += frameLength;
+        if ( frameTime > terminal.maxFrameTime )
+            terminal.maxFrameTime = frameTime;
+    }
+
+    LeaveCriticalSection( &terminalDrawLock );
 
 }
 
-void choose_availableInterlocutor () {
-    //. funzione che chiede all'utente di scegliere un dispositivo tra quelli disponibili
+void terminal_printf ( const char *format , ... ) {
+    //. funzione che scrive nel riquadro dei messaggi: il testo viene solo messo nella cronologia, lo disegna il thread dell'interfaccia
 
-    list_availableInterlocutors();
+    char text[2*TERMINAL_LINE_LEN];
+    va_list arguments;
+    va_start( arguments , format );
+    int textLength = vsnprintf( text , sizeof(text) , format , arguments );
+    va_end( arguments );
+    if ( textLength < 0 )
+        return;
+    if ( textLength >= (int) sizeof(text) )
+        textLength = sizeof(text) - 1;
 
-    // chiedo all'utente di scegliere un interlocutore in base al MAC address (è sicuramente univoco)
-    char chosenAddressString[18];
-    printf("Choose a device (by MAC address): ");
-    fgets( chosenAddressString , 18 , stdin );
+    // prima dell'avvio dell'interfaccia ( e dopo la chiusura ) si stampa direttamente
+    if ( terminal.active == FALSE ) {
+        printf( "%s\n" , text );
+        fflush( stdout );
+        return;
+    }
 
-    // setto il terminatore al posto del carattere di newline
-    for ( int i=0 ; i<18 ; i++ ) {
-        if ( chosenAddressString[i] == '\n' ) {
-            chosenAddressString[i] = '\0';
-            break;
+    // ogni riga del testo diventa una riga della cronologia
+    EnterCriticalSection( &terminalLock );
+    char *lineStart = text;
+    char *textEnd = text + textLength;
+    while ( lineStart < textEnd ) {
+        char *lineEnd = memchr( lineStart , '\n' , textEnd - lineStart );
+        if ( lineEnd == NULL )
+            lineEnd = textEnd;
+
+        // con l'output rediretto nessuna riga va persa: se la cronologia è piena di righe non ancora scritte attendo che il thread di disegno le scriva
+        if ( terminal.console == FALSE && terminal.linesWritten - terminal.linesShown >= TERMINAL_SCROLLBACK_LEN )
+            terminal.writerWaits++;
+        while ( terminal.console == FALSE && terminal.active && terminal.linesWritten - terminal.linesShown >= TERMINAL_SCROLLBACK_LEN ) {
+            WakeConditionVariable( &terminalBacklog );
+            SleepConditionVariableCS( &terminalNotFull , &terminalLock , TERMINAL_FRAME_INTERVAL );
         }
-    }
 
-    // converto la stringa in un indirizzo MAC
-    mac_address chosenAddress;
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ ) {
-        sscanf( chosenAddressString+3*i , "%02x" , &chosenAddress.addressBytes[i] );
-    }
-        
-    // cerco il dispositivo scelto nella lista dei dispositivi disponibili
-    availableInterlocutorsList *currentInterlocutor;
-    for ( currentInterlocutor=availableInterlocutorsHead ; currentInterlocutor ; currentInterlocutor=currentInterlocutor->next ) {
-        if ( memcmp( currentInterlocutor->interlocutor.address.addressBytes , chosenAddress.addressBytes , ETHER_ADDR_LEN ) == 0 )
-            break;
-    }
+        add_terminalLine( lineStart , lineEnd - lineStart );
+        lineStart = lineEnd + 1;
 
-    // se non ho trovato il dispositivo scelto, allora esco
-    if ( currentInterlocutor == NULL ) {
-        fprintf( stderr , "\nError: device not found. Restart the program." );
-        Sleep(10000); // 10 secondi
-        exit(1);
+        // a metà cronologia il thread di disegno non aspetta la fine dell'intervallo, così chi scrive di solito non attende
+        if ( terminal.console == FALSE && terminal.linesWritten - terminal.linesShown == TERMINAL_SCROLLBACK_LEN / 2 )
+            WakeConditionVariable( &terminalBacklog );
     }
+    LeaveCriticalSection( &terminalLock );
 
-    // "ufficializzo" la scelta del dispositivo
-    set_dsapAddress( currentInterlocutor->interlocutor.address.addressBytes );
-    myInterlocutor = currentInterlocutor->interlocutor;
-    SetConsoleTitle( myInterlocutor.name );
+}
+
+void print_statsLine ( FILE *stream , const char *format , ... ) {
+    //. funzione che stampa una riga di statistiche nel riquadro dei messaggi ( stdout ) o su un altro stream
+
+    char line[TERMINAL_LINE_LEN];
+    va_list arguments;
+    va_start( arguments , format );
+    vsnprintf( line , sizeof(line) , format , arguments );
+    va_end( arguments );
+
+    if ( stream == stdout )
+        terminal_printf( "%s" , line );
+    else
+        fprintf( stream , "%s\n" , line );
 
 }
 
+DWORD WINAPI draw_terminal ( void *data ) {
+    //. funzione eseguita dal thread che disegna l'interfaccia a frequenza limitata
 
+    while ( terminal.active ) {
 
+        // attendo l'intervallo tra due disegni, o meno se l'output rediretto ha già mezza cronologia da scrivere
+        EnterCriticalSection( &terminalLock );
+        if ( terminal.console || terminal.linesWritten - terminal.linesShown < TERMINAL_SCROLLBACK_LEN / 2 )
+            SleepConditionVariableCS( &terminalBacklog , &terminalLock , TERMINAL_FRAME_INTERVAL );
+        LeaveCriticalSection( &terminalLock );
 
+        if ( terminal.active )
+            draw_terminalFrame();
 
+    }
 
-//! === STCS SENDING-RECEIVING SECTION ===
-void send_STCS ( pcap_t *nicHandle ) {
-    //. funzione che invia una STCS al dispositivo specificato
+    return 0;
 
-    u_char packet[500];
-    
-    // setto il DSAP al MAC del dispositivo specificato
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i] = dsapAddress.addressBytes[i];
+}
+
+void stop_terminal () {
+    //. funzione che disegna quanto manca e restituisce la console com'era ( eseguita anche alla chiusura del programma )
+
+    if ( terminal.active == FALSE )
+        return;
+
+    draw_terminalFrame();
+    terminal.active = FALSE;
+
+    // tolgo la regione di scorrimento e lascio il cursore sotto l'ultimo messaggio
+    if ( terminal.console ) {
+        EnterCriticalSection( &terminalDrawLock );
+        char reset[50];
+        int resetLength = sprintf( reset , "\x1b[r\x1b[%d;1H\x1b[2K" , terminal.rows );
+        DWORD writtenBytes;
+        WriteFile( terminal.outputHandle , reset , resetLength , &writtenBytes , NULL );
+        LeaveCriticalSection( &terminalDrawLock );
+    }
+    if ( terminal.keyboard )
+        SetConsoleMode( terminal.inputHandle , terminal.inputMode );
+
+}
+
+void start_terminal () {
+    //. funzione che avvia l'interfaccia: riquadro dei messaggi con cronologia, riga di input separata, disegno a frequenza limitata
+
+    terminalFrame = (char*) malloc( TERMINAL_FRAME_LEN );
+    if ( terminalFrame == NULL ) {
+        fprintf( stderr , "Error allocating the terminal buffer. Restart the program.\n" );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // le sequenze VT servono per la regione di scorrimento; senza ( output rediretto ) le righe vengono solo accodate
+    DWORD outputMode;
+    terminal.outputHandle = GetStdHandle( STD_OUTPUT_HANDLE );
+    terminal.inputHandle = GetStdHandle( STD_INPUT_HANDLE );
+    terminal.console = GetConsoleMode( terminal.outputHandle , &outputMode )
+                       && SetConsoleMode( terminal.outputHandle , outputMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING );
+
+    // la riga di input viene disegnata dal programma, quindi la console non deve fare l'eco dei tasti
+    terminal.keyboard = terminal.console && GetConsoleMode( terminal.inputHandle , &terminal.inputMode )
+                        && SetConsoleMode( terminal.inputHandle , ( terminal.inputMode & ~( ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT ) ) | ENABLE_WINDOW_INPUT );
+
+    terminal.fullRedraw = TRUE;
+    terminal.inputChanged = TRUE;
+    InitializeConditionVariable( &terminalBacklog );
+    InitializeConditionVariable( &terminalNotFull );
+    fflush( stdout );
+    terminal.active = TRUE;
+
+    DWORD threadID;
+    HANDLE threadHandle = CreateThread( NULL , 0 , draw_terminal , NULL , 0 , &threadID );
+    if ( threadHandle == NULL ) {
+        fprintf( stderr , "Error creating the thread used to draw the terminal. Restart the program.\n" );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    atexit( stop_terminal );
+
+}
+
+void scroll_terminal ( int pages ) {
+    //. funzione che sposta la parte di cronologia mostrata di un certo numero di pagine ( negativo = indietro ) ( da chiamare con terminalLock preso )
+
+    int paneRows = terminal.rows - 1;
+    unsigned long long oldestLine = ( terminal.linesWritten > TERMINAL_SCROLLBACK_LEN ) ? terminal.linesWritten - TERMINAL_SCROLLBACK_LEN : 0;
+    long long viewEnd = ( terminal.viewEnd == 0 ) ? (long long) terminal.linesWritten : (long long) terminal.viewEnd;
+
+    viewEnd += (long long) pages * paneRows;
+    if ( viewEnd < (long long) oldestLine + paneRows )
+        viewEnd = oldestLine + paneRows;
+
+    // tornato in fondo il riquadro segue di nuovo i nuovi messaggi
+    terminal.viewEnd = ( viewEnd >= (long long) terminal.linesWritten ) ? 0 : viewEnd;
+    terminal.fullRedraw = TRUE;
+
+}
+
+void read_terminalLine ( char *line , int lineLength ) {
+    //. funzione che legge una riga scritta dall'utente mentre i messaggi continuano ad arrivare nel riquadro sopra
+
+    // senza tastiera ( input rediretto ) leggo normalmente
+    if ( terminal.active == FALSE || terminal.keyboard == FALSE ) {
+        fgets( line , lineLength , stdin );
+        return;
+    }
+
+    INPUT_RECORD inputRecord;
+    DWORD readRecords;
+    while ( ReadConsoleInputA( terminal.inputHandle , &inputRecord , 1 , &readRecords ) ) {
+
+        if ( inputRecord.EventType != KEY_EVENT || inputRecord.Event.KeyEvent.bKeyDown == FALSE )
+            continue;
+        WORD key = inputRecord.Event.KeyEvent.wVirtualKeyCode;
+        char character = inputRecord.Event.KeyEvent.uChar.AsciiChar;
+
+        EnterCriticalSection( &terminalLock );
+
+        if ( key == VK_RETURN ) {
+            // la riga scritta finisce nel riquadro dei messaggi e la riga di input si svuota
+            char sentLine[TERMINAL_INPUT_LEN+10];
+            int sentLength = sprintf( sentLine , "You : %.*s" , terminal.inputLength , terminal.input );
+            add_terminalLine( sentLine , sentLength );
+            if ( terminal.viewEnd != 0 ) {
+                terminal.viewEnd = 0;
+                terminal.fullRedraw = TRUE;
+            }
+
+            int copiedLength = ( terminal.inputLength < lineLength-2 ) ? terminal.inputLength : lineLength-2;
+            memcpy( line , terminal.input , copiedLength );
+            line[copiedLength] = '\n';
+            line[copiedLength+1] = '\0';
+            terminal.inputLength = 0;
+            terminal.inputChanged = TRUE;
+
+            LeaveCriticalSection( &terminalLock );
+            return;
+        }
+
+        if ( key == VK_BACK && terminal.inputLength > 0 ) {
+            terminal.inputLength--;
+            terminal.inputChanged = TRUE;
+        }
+        else if ( key == VK_PRIOR ) {
+            scroll_terminal( -1 );
+        }
+        else if ( key == VK_NEXT ) {
+            scroll_terminal( 1 );
+        }
+        else if ( (u_char) character >= 32 && character != 127 && terminal.inputLength < TERMINAL_INPUT_LEN-2 && terminal.inputLength < lineLength-2 ) {
+            terminal.input[terminal.inputLength++] = character;
+            terminal.inputChanged = TRUE;
+        }
+
+        LeaveCriticalSection( &terminalLock );
+
+    }
+
+    // la console non è più leggibile
+    line[0] = '\0';
+
+}
+
+void print_terminalStats ( FILE *stream ) {
+    //. funzione che stampa quanto lavoro ha fatto l'interfaccia
+
+    print_statsLine( stream , "Terminal: %llu frames, %llu lines drawn, %llu only in scrollback, %llu lost, %.1f KB written, slowest frame %.2f ms, %llu waits for the drawing" ,
+                     terminal.frames , terminal.linesDrawn , terminal.linesSkipped , terminal.linesLost , terminal.bytesWritten / 1024.0 , terminal.maxFrameTime , terminal.writerWaits );
+
+}
+
+
+
+
+
+
+//! === TRANSMIT SCHEDULER SECTION ===
+double elapsed_seconds ( LARGE_INTEGER since ) {
+    //. funzione che restituisce i secondi trascorsi dall'istante specificato
+
+    LARGE_INTEGER now , frequency;
+    QueryPerformanceCounter( &now );
+    QueryPerformanceFrequency( &frequency );
+
+    return (double) ( now.QuadPart - since.QuadPart ) / frequency.QuadPart;
+
+}
+
+void rehome_queuedPacket ( queuedPacket *slot ) {
+    //. funzione che sposta sul link della sessione un pacchetto accodato per un link che non porta più la sessione ( transmitLock deve essere preso )
+
+    // finché la sessione è sul link 0 nessun pacchetto va spostato; i blocchi dei link aggiuntivi non passano dallo scheduler
+    if ( sessionLink == 0 )
+        return;
+
+    for ( int i=0 ; i<stripeLinksCount ; i++ ) {
+        if ( i == sessionLink || slot->nicHandle != stripeLinks[i].nicHandle )
+            continue;
+        slot->nicHandle = stripeLinks[sessionLink].nicHandle;
+        memcpy( slot->packet , stripeLinks[sessionLink].peerAddress.addressBytes , ETHER_ADDR_LEN );
+        memcpy( slot->packet+ETHER_ADDR_LEN , stripeLinks[sessionLink].localAddress.addressBytes , ETHER_ADDR_LEN );
+        return;
+    }
+
+}
+
+void store_queuedPacket ( transmitQueue *queue , pcap_t *nicHandle , const u_char *packet , int packetLength ) {
+    //. funzione che copia un pacchetto nel primo posto libero della coda e sveglia lo scheduler ( transmitLock deve essere preso )
+
+    queuedPacket *slot = &queue->slots[( queue->head + queue->count ) % TRANSMIT_QUEUE_LEN];
+    slot->nicHandle = nicHandle;
+    slot->packetLength = packetLength;
+    memcpy( slot->packet , packet , packetLength );
+    QueryPerformanceCounter( &slot->enqueueTime );
+
+    // chi invia usa ancora la NIC principale anche dopo che la sessione è passata su un altro link
+    rehome_queuedPacket( slot );
+
+    // aggiorno le statistiche della coda
+    queue->count++;
+    if ( queue->count > queue->maxDepth )
+        queue->maxDepth = queue->count;
+
+    WakeConditionVariable( &transmitNotEmpty );
+
+}
+
+void enqueue_packet ( pcap_t *nicHandle , const u_char *packet , int packetLength , transmitClass packetClass ) {
+    //. funzione che accoda un pacchetto nella coda della sua classe ( se la coda è piena attende che si liberi )
+
+    // durante la riproduzione di un file pcap non c'è nessuna NIC su cui inviare
+    if ( replayMode )
+        return;
+
+    EnterCriticalSection( &transmitLock );
+
+    transmitQueue *queue = &transmitQueues[packetClass];
+    while ( queue->count == TRANSMIT_QUEUE_LEN )
+        SleepConditionVariableCS( &transmitNotFull , &transmitLock , INFINITE );
+    store_queuedPacket( queue , nicHandle , packet , packetLength );
+
+    LeaveCriticalSection( &transmitLock );
+
+}
+
+boolean try_enqueuePacket ( pcap_t *nicHandle , const u_char *packet , int packetLength , transmitClass packetClass ) {
+    //. funzione che accoda un pacchetto senza mai attendere: se la coda è piena lo scarta e lo conta ( usata dal thread di ricezione )
+
+    if ( replayMode )
+        return TRUE;
+
+    EnterCriticalSection( &transmitLock );
+
+    // il thread di ricezione non deve fermarsi: la risposta persa viene recuperata dai timeout dell'interlocutore
+    transmitQueue *queue = &transmitQueues[packetClass];
+    boolean queued = ( queue->count < TRANSMIT_QUEUE_LEN );
+    if ( queued )
+        store_queuedPacket( queue , nicHandle , packet , packetLength );
+    else
+        queue->droppedPackets++;
+
+    LeaveCriticalSection( &transmitLock );
+
+    return queued;
+
+}
+
+boolean wait_transmitQueue ( transmitClass packetClass , DWORD timeout ) {
+    //. funzione che attende che tutti i pacchetti di una classe siano stati inviati ( FALSE se il tempo scade prima )
+
+    boolean drained = TRUE;
+
+    EnterCriticalSection( &transmitLock );
+    while ( transmitQueues[packetClass].count > 0 || transmitQueues[packetClass].sending > 0 ) {
+        if ( SleepConditionVariableCS( &transmitDrained , &transmitLock , timeout ) == 0 ) {
+            drained = FALSE;
+            break;
+        }
+    }
+    LeaveCriticalSection( &transmitLock );
+
+    return drained;
+
+}
+
+DWORD WINAPI transmit_scheduler ( void *data ) {
+    //. funzione eseguita dal thread che invia i pacchetti: prima quelli di controllo, poi quelli interattivi, infine i dati
+
+    while (1) {
+
+        EnterCriticalSection( &transmitLock );
+
+        // attendo che ci sia almeno un pacchetto e scelgo la classe con priorità più alta
+        int packetClass;
+        while (1) {
+            for ( packetClass=0 ; packetClass<TRANSMIT_CLASSES ; packetClass++ )
+                if ( transmitQueues[packetClass].count > 0 )
+                    break;
+            if ( packetClass < TRANSMIT_CLASSES )
+                break;
+            SleepConditionVariableCS( &transmitNotEmpty , &transmitLock , INFINITE );
+        }
+
+        transmitQueue *queue = &transmitQueues[packetClass];
+
+        // ogni classe viene inviata a raffiche di al massimo TRANSMIT_BURST pacchetti per la stessa NIC,
+        // così una chiamata al driver vale per più pacchetti ed un pacchetto di controllo attende al più una raffica
+        pcap_t *nicHandle = queue->slots[queue->head].nicHandle;
+        bulkSendQueue->len = 0;
+        int taken = 0;
+        while ( taken < TRANSMIT_BURST && taken < queue->count && queue->slots[( queue->head + taken ) % TRANSMIT_QUEUE_LEN].nicHandle == nicHandle ) {
+
+            queuedPacket *slot = &queue->slots[( queue->head + taken ) % TRANSMIT_QUEUE_LEN];
+
+            // aggiorno il tempo di attesa nella coda
+            double wait = elapsed_seconds( slot->enqueueTime );
+            queue->totalWait += wait;
+            if ( wait > queue->maxWait )
+                queue->maxWait = wait;
+
+            packetHeader queuedHeader;
+            memset( &queuedHeader , 0 , sizeof(queuedHeader) );
+            queuedHeader.caplen = queuedHeader.len = slot->packetLength;
+            pcap_sendqueue_queue( bulkSendQueue , &queuedHeader , slot->packet );
+
+            taken++;
+
+        }
+
+        // l'invio avviene fuori dalla sezione critica: i posti restano occupati finché non è finito
+        queue->sending = taken;
+        LeaveCriticalSection( &transmitLock );
+
+        LARGE_INTEGER transmitStart;
+        QueryPerformanceCounter( &transmitStart );
+        u_int sentBytes = pcap_sendqueue_transmit( nicHandle , bulkSendQueue , 0 );
+        double transmitSeconds = elapsed_seconds( transmitStart );
+
+        EnterCriticalSection( &transmitLock );
+        queue->head = ( queue->head + taken ) % TRANSMIT_QUEUE_LEN;
+        queue->count -= taken;
+        queue->sending = 0;
+        queue->sentPackets += taken;
+        queue->transmitBytes += sentBytes;
+        queue->transmitSeconds += transmitSeconds;
+        WakeAllConditionVariable( &transmitNotFull );
+        WakeAllConditionVariable( &transmitDrained );
+        LeaveCriticalSection( &transmitLock );
+
+        // gestione dell'eventuale errore: se la sessione ha altri link il link che non invia più viene escluso dai blocchi,
+        // ed i ping senza risposta fanno spostare la sessione su un altro link
+        if ( sentBytes < bulkSendQueue->len ) {
+            boolean linkFailed = FALSE;
+            for ( int i=0 ; i<stripeLinksCount ; i++ ) {
+                if ( stripeLinksCount > 1 && stripeLinks[i].nicHandle == nicHandle ) {
+                    stripeLinks[i].up = FALSE;
+                    linkFailed = TRUE;
+                }
+            }
+            if ( linkFailed )
+                continue;
+            fprintf( stderr , "\nError sending the packet: %s. Restart the program." , pcap_geterr(nicHandle) );
+            Sleep(10000); // 10 secondi
+            exit(1);
+        }
+
+    }
+
+}
+
+void start_transmitScheduler () {
+    //. funzione che prepara le code di invio ed avvia il thread che le svuota
+
+    InitializeCriticalSection( &transmitLock );
+    InitializeConditionVariable( &transmitNotEmpty );
+    InitializeConditionVariable( &transmitNotFull );
+    InitializeConditionVariable( &transmitDrained );
+
+    for ( int i=0 ; i<TRANSMIT_CLASSES ; i++ ) {
+        memset( &transmitQueues[i] , 0 , sizeof(transmitQueue) );
+        transmitQueues[i].slots = (queuedPacket*) malloc( TRANSMIT_QUEUE_LEN * sizeof(queuedPacket) );
+    }
+    bulkSendQueue = pcap_sendqueue_alloc( TRANSMIT_BURST * ( TRANSMIT_PACKET_LEN + sizeof(packetHeader) ) );
+
+    DWORD threadID;
+    HANDLE threadHandle = CreateThread( NULL , 0 , transmit_scheduler , NULL , 0 , &threadID );
+    if ( threadHandle == NULL || bulkSendQueue == NULL ) {
+        fprintf( stderr , "Error creating the thread used to send packets. Restart the program.\n" );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+}
+
+void print_transmitStats () {
+    //. funzione che stampa profondità e tempi di attesa di ogni coda di invio
+
+    const char *classNames[TRANSMIT_CLASSES] = { "control" , "interactive" , "bulk" };
+
+    EnterCriticalSection( &transmitLock );
+    for ( int i=0 ; i<TRANSMIT_CLASSES ; i++ ) {
+        transmitQueue *queue = &transmitQueues[i];
+        print_statsLine( stdout , "%-12s sent %llu, dropped %llu, queued %d (max %d), wait avg %.3f ms max %.3f ms" , classNames[i] , queue->sentPackets , queue->droppedPackets , queue->count , queue->maxDepth ,
+                queue->sentPackets > 0 ? queue->totalWait * 1000 / queue->sentPackets : 0 , queue->maxWait * 1000 );
+    }
+    LeaveCriticalSection( &transmitLock );
+
+}
+
+
+
+
+
+
+//! === MEMORY AND ADMISSION SECTION ===
+char *allocate_messageBuffer ( int bufferLength ) {
+    //. funzione che prende un buffer dall'arena circolare dei messaggi ( vale solo fino alla chiamata successiva: chi vuole tenere il messaggio lo copia )
+
+    if ( messageArenaHead + bufferLength > MESSAGE_ARENA_LEN )
+        messageArenaHead = 0;
+
+    char *buffer = messageArena + messageArenaHead;
+    messageArenaHead += bufferLength;
+
+    return buffer;
+
+}
+
+availableInterlocutorsList *allocate_availableInterlocutor () {
+    //. funzione che prende un elemento dal pool dei dispositivi disponibili: se è finito riusa il più vecchio ( in fondo alla lista )
+
+    if ( availableInterlocutorsCount < availableInterlocutorsPoolLen )
+        return &availableInterlocutorsPool[availableInterlocutorsCount++];
+
+    availableInterlocutorsList **last = &availableInterlocutorsHead;
+    while ( (*last)->next != NULL )
+        last = &(*last)->next;
+
+    availableInterlocutorsList *oldestInterlocutor = *last;
+    *last = NULL;
+
+    return oldestInterlocutor;
+
+}
+
+admissionSource *find_admissionSource ( const u_char *sourceAddress , unsigned long long now ) {
+    //. funzione che cerca un mittente nella tabella di ammissione ( se non c'è lo aggiunge al posto del meno recente )
+
+    // hash FNV-1a del MAC
+    unsigned int hash = 2166136261u;
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        hash = ( hash ^ sourceAddress[i] ) * 16777619u;
+
+    admissionSource *oldestSource = NULL;
+    for ( int i=0 ; i<ADMISSION_PROBES ; i++ ) {
+
+        admissionSource *source = &admissionSources[( hash + i ) & ( ADMISSION_SOURCES - 1 )];
+        if ( source->used && memcmp( source->address.addressBytes , sourceAddress , ETHER_ADDR_LEN ) == 0 )
+            return source;
+
+        if ( oldestSource == NULL || source->used == FALSE || ( oldestSource->used && source->lastSeen < oldestSource->lastSeen ) )
+            oldestSource = source;
+
+    }
+
+    // nuovo mittente: parte con un solo pacchetto a disposizione, così cambiare MAC ad ogni pacchetto non regala una raffica
+    oldestSource->used = TRUE;
+    memcpy( oldestSource->address.addressBytes , sourceAddress , ETHER_ADDR_LEN );
+    for ( int c=0 ; c<ADMISSION_CLASSES ; c++ ) {
+        oldestSource->buckets[c].tokens = 1;
+        oldestSource->buckets[c].lastRefill = now;
+    }
+
+    return oldestSource;
+
+}
+
+void refill_tokenBucket ( tokenBucket *bucket , unsigned long long now , double rate , double burst ) {
+    //. funzione che ricarica un secchio in base al tempo passato ( senza superare il massimo )
+
+    if ( now > bucket->lastRefill ) {
+        bucket->tokens += ( now - bucket->lastRefill ) * rate / 1000000;
+        if ( bucket->tokens > burst )
+            bucket->tokens = burst;
+        bucket->lastRefill = now;
+    }
+
+}
+
+boolean admit_packet ( const u_char *packetData , const packetHeader *header , admissionClass packetClass ) {
+    //. funzione che decide se un pacchetto va gestito o scartato, in base a quanti pacchetti della stessa classe ha inviato il mittente
+
+    // uso l'istante di cattura, così la riproduzione di un file pcap si comporta come la ricezione reale
+    unsigned long long now = (unsigned long long) header->ts.tv_sec * 1000000 + header->ts.tv_usec;
+
+    EnterCriticalSection( &admissionLock );
+
+    // i secchi complessivi partono pieni dal primo pacchetto ( i file pcap iniziano dall'istante 0 )
+    if ( admissionTotalStarted == FALSE ) {
+        for ( int c=0 ; c<ADMISSION_CLASSES ; c++ ) {
+            admissionTotal[c].tokens = admissionTotalBursts[c];
+            admissionTotal[c].lastRefill = now;
+        }
+        admissionTotalStarted = TRUE;
+    }
+
+    admissionSource *source = find_admissionSource( packetData+ETHER_ADDR_LEN , now );
+    source->lastSeen = now;
+
+    tokenBucket *bucket = &source->buckets[packetClass];
+    tokenBucket *totalBucket = &admissionTotal[packetClass];
+    refill_tokenBucket( bucket , now , admissionRates[packetClass] , admissionBursts[packetClass] );
+    refill_tokenBucket( totalBucket , now , admissionTotalRates[packetClass] , admissionTotalBursts[packetClass] );
+
+    // il pacchetto deve rientrare sia nel limite del mittente sia in quello complessivo della classe
+    boolean admitted = ( bucket->tokens >= 1 && totalBucket->tokens >= 1 );
+    if ( admitted ) {
+        bucket->tokens -= 1;
+        totalBucket->tokens -= 1;
+        admissionAccepted[packetClass]++;
+    }
+    else {
+        admissionShed[packetClass]++;
+        if ( bucket->tokens >= 1 )
+            admissionTotalShed[packetClass]++;
+    }
+
+    LeaveCriticalSection( &admissionLock );
+
+    return admitted;
+
+}
+
+void print_admissionStats ( FILE *stream ) {
+    //. funzione che stampa quanti pacchetti sono stati ammessi e scartati e quanta memoria dei pool è in uso
+
+    const char *classNames[ADMISSION_CLASSES] = { "discovery" , "message" };
+
+    EnterCriticalSection( &admissionLock );
+    for ( int i=0 ; i<ADMISSION_CLASSES ; i++ )
+        print_statsLine( stream , "%-12s admitted %llu, shed %llu (%llu by the total limit)" , classNames[i] , admissionAccepted[i] , admissionShed[i] , admissionTotalShed[i] );
+    LeaveCriticalSection( &admissionLock );
+
+    print_statsLine( stream , "Known devices: %d of %d, message arena: %d KB" , availableInterlocutorsCount , availableInterlocutorsPoolLen , MESSAGE_ARENA_LEN / 1024 );
+
+}
+
+void report_shedMessages () {
+    //. funzione che comunica all'utente quanti messaggi sono stati scartati dal controllo di ammissione ( al massimo una volta al secondo )
+
+    EnterCriticalSection( &admissionLock );
+    unsigned long long shedMessages = admissionShed[ADMISSION_MESSAGE];
+    LeaveCriticalSection( &admissionLock );
+
+    if ( shedMessages == shedMessagesReported || GetTickCount() - shedReportTick < 1000 )
+        return;
+
+    terminal_printf( "%llu messages from devices that are not members have been discarded (%llu in total)" , shedMessages - shedMessagesReported , shedMessages );
+    shedMessagesReported = shedMessages;
+    shedReportTick = GetTickCount();
+
+}
+
+
+
+
+
+
+//! === RTCS SENDING-RECEIVING SECTION ===
+void choose_displayName () {
+    //. funzione che fa scegliere all'utente il nome con cui gli altri dispositivi lo visualizzano ( solo se non è già stato scelto )
+
+    if ( displayName[0] != '\0' )
+        return;
+
+    char name[51]; // 50 caratteri + 1 per il terminatore
+    printf("Choose a name (long between 10 and 50 characters): ");
+    fgets( name , 51 , stdin );
+
+    // controllo che il nome sia lungo almeno 10 caratteri e che non sia più lungo di 50 caratteri. Se non lo è, uso un nome di default
+    if ( strlen(name) < 10 || strlen(name) > 50 )
+        strcpy( name , "NoNameDevice\n" );
+
+    // tolgo il carattere di newline
+    name[strcspn( name , "\n" )] = '\0';
+    strcpy( displayName , name );
+
+}
+
+void broadcast_RTCS ( pcap_t *nicHandle ) {
+    //. funzione che "broadcasta" una RTCS sulla rete locale
+
+    u_char packet[500];
+    
+    // setto il DSAP a 0xFF ( il pacchetto deve essere broadcastato )
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = 0xff;
 
     // setto il SSAP in modo tale che sia uguale al mio MAC
     for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i-ETHER_ADDR_LEN];
-    
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+    
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 0 ( per far riconoscere la RTCS )
+    packet[14] = 0x00;
+
+    // setto il nome con cui i PC che ascoltano lo visualizzano ed il terminatore
+    choose_displayName();
+    strcpy( (char*) packet+15 , displayName );
+
+    // accodo il pacchetto tra quelli di controllo
+    enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void add_availableInterlocutor ( const u_char *packetData ) {
+    //. funzione che stampa il dispositivo che ha inviato una RTCS e lo aggiunge alla lista dei dispositivi disponibili
+
+    // se il dispositivo è già nella lista aggiorno solo il nome ( le RTCS vengono ripetute )
+    availableInterlocutorsList *newInterlocutor;
+    for ( newInterlocutor=availableInterlocutorsHead ; newInterlocutor ; newInterlocutor=newInterlocutor->next )
+        if ( memcmp( newInterlocutor->interlocutor.address.addressBytes , packetData+ETHER_ADDR_LEN , ETHER_ADDR_LEN ) == 0 )
+            break;
+    boolean knownInterlocutor = ( newInterlocutor != NULL );
+
+    // altrimenti prendo un elemento dal pool dei dispositivi disponibili
+    if ( knownInterlocutor == FALSE )
+        newInterlocutor = allocate_availableInterlocutor();
+
+    // copio il nome ( al massimo 49 caratteri + il terminatore )
+    newInterlocutor->interlocutor.name[49] = '\0';
+    for ( int i=0 ; i<49 ; i++ ) {
+
+        if ( packetData[i+15] == '\0' ) {
+            newInterlocutor->interlocutor.name[i] = '\0';
+            break;
+        }
+        newInterlocutor->interlocutor.name[i] = packetData[i+15];
+    
+    }
+
+    if ( knownInterlocutor )
+        return;
+    
+    // copio l'indirizzo MAC del dispositivo
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        newInterlocutor->interlocutor.address.addressBytes[i] = packetData[i+ETHER_ADDR_LEN];
+    
+    // aggiorno la lista ( in testa )
+    newInterlocutor->next = availableInterlocutorsHead;
+    availableInterlocutorsHead = newInterlocutor;
+
+    // nella simulazione i dispositivi trovati non vengono stampati
+    if ( simulationMode )
+        return;
+
+    // stampo il nome e il MAC del nuovo dispositivo
+    printf( "%s : " , newInterlocutor->interlocutor.name );
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ ) {
+    
+        printf( "%02x" , packetData[i+6] );
+        if ( i != ETHER_ADDR_LEN-1 )
+            printf( ":" );
+
+    }
+    printf( "\n" );
+
+}
+
+void list_availableInterlocutors ( pcap_t *nicHandle ) {
+    //. funzione che elenca i dispositivi che hanno inviato RTCS
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+    boolean receivedRTCS = FALSE; // variabile che indica se ho ricevuto almeno una RTCS
+
+    // variabili per un timer che interrompa l'ascolto dopo un certo tempo
+    int milliseconds = 0 , trigger = 30000; // 30 secondi
+    clock_t start = clock();
+
+    while ( ((readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0) && (milliseconds<trigger) ) {
+        if ( readingResult == 0 ) { // nessun pacchetto ricevuto
+            printf("Timeout expired. Restart the program.\n");
+            Sleep(10000); // 10 secondi
+            exit(1);
+        }
+
+        // aggiorno il timer
+        clock_t difference = clock() - start;
+        milliseconds = difference * 1000 / CLOCKS_PER_SEC;
+
+
+
+        //. controlli sulla validità del pacchetto
+        // controllo che il pacchetto ricevuto sia un RTCS
+        if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x00 )
+            continue;
+
+        // scarto le RTCS dei dispositivi che le inviano troppo spesso
+        if ( admit_packet( packetData , header , ADMISSION_DISCOVERY ) == FALSE )
+            continue;
+
+
+
+        //. operazioni da eseguire se il pacchetto è valido
+        receivedRTCS = TRUE;
+        add_availableInterlocutor( packetData );
+
+    }
+
+    if ( receivedRTCS == FALSE ) {
+        printf("No RTCS has been received. Restart the program.\n");
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+}
+
+void choose_availableInterlocutor ( pcap_t *nicHandle ) {
+    //. funzione che chiede all'utente di scegliere un dispositivo tra quelli disponibili
+
+    list_availableInterlocutors( nicHandle );
+
+    // chiedo all'utente di scegliere un interlocutore in base al MAC address (è sicuramente univoco)
+    char chosenAddressString[18];
+    printf("Choose a device (by MAC address): ");
+    fgets( chosenAddressString , 18 , stdin );
+
+    // setto il terminatore al posto del carattere di newline
+    for ( int i=0 ; i<18 ; i++ ) {
+        if ( chosenAddressString[i] == '\n' ) {
+            chosenAddressString[i] = '\0';
+            break;
+        }
+    }
+
+    // converto la stringa in un indirizzo MAC ( %x scrive un unsigned int, non un byte )
+    mac_address chosenAddress;
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ ) {
+        unsigned int addressByte = 0;
+        sscanf( chosenAddressString+3*i , "%02x" , &addressByte );
+        chosenAddress.addressBytes[i] = addressByte;
+    }
+        
+    // cerco il dispositivo scelto nella lista dei dispositivi disponibili
+    availableInterlocutorsList *currentInterlocutor;
+    for ( currentInterlocutor=availableInterlocutorsHead ; currentInterlocutor ; currentInterlocutor=currentInterlocutor->next ) {
+        if ( memcmp( currentInterlocutor->interlocutor.address.addressBytes , chosenAddress.addressBytes , ETHER_ADDR_LEN ) == 0 )
+            break;
+    }
+
+    // se non ho trovato il dispositivo scelto, allora esco
+    if ( currentInterlocutor == NULL ) {
+        fprintf( stderr , "\nError: device not found. Restart the program." );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // "ufficializzo" la scelta del dispositivo
+    set_dsapAddress( currentInterlocutor->interlocutor.address.addressBytes );
+    myInterlocutor = currentInterlocutor->interlocutor;
+    SetConsoleTitle( myInterlocutor.name );
+
+}
+
+
+
+
+
+
+//! === STCS SENDING-RECEIVING SECTION ===
+void send_STCS ( pcap_t *nicHandle ) {
+    //. funzione che invia una STCS al dispositivo specificato
+
+    u_char packet[500];
+    
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+    
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 1 ( per far riconoscere la STCS )
+    packet[14] = 0x01;
+
+    // setto il nome con cui l'interlocutore lo visualizzerà ed il terminatore
+    choose_displayName();
+    strcpy( (char*) packet+15 , displayName );
+
+    // accodo il pacchetto tra quelli di controllo
+    enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void accept_STCS ( const u_char *packetData ) {
+    //. funzione che salva il cMaster che ha inviato una STCS come interlocutore
+
+    // setto il DSAP al MAC del mittente
+    set_dsapAddress( packetData+ETHER_ADDR_LEN );
+
+    // copio il nome del mittente nelle variabili globali ( al massimo 49 caratteri + il terminatore )
+    strncpy( myInterlocutor.name , (const char*) packetData+15 , 49 );
+    myInterlocutor.name[49] = '\0';
+    myInterlocutor.address = dsapAddress;
+    if ( simulationMode == FALSE )
+        SetConsoleTitle( myInterlocutor.name );
+
+}
+
+void receive_STCS ( pcap_t *nicHandle ) {
+    //. funzione che attende una STCS
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+
+    // variabili per un timer che interrompa l'ascolto dopo un certo tempo
+    int milliseconds = 0 , trigger = 60000; // 60 secondi
+    clock_t start = clock();
+
+    while ( ((readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0) && (milliseconds<trigger) ) {
+        if ( readingResult == 0 ) {
+            printf("Timeout expired. Restart the program.\n");
+            exit(0);
+        }
+
+        // aggiorno il timer
+        clock_t difference = clock() - start;
+        milliseconds = difference * 1000 / CLOCKS_PER_SEC;
+
+
+
+        //. controlli sulla validità del pacchetto
+        // controllo che il pacchetto sia di tipo STCS
+        if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x01 )
+            continue;
+
+        // controllo che il pacchetto sia per me ( il mittente non viene controllato: è la STCS a farmi conoscere il cMaster )
+        if ( memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+            continue;
+
+
+
+        //. operazioni da eseguire se il pacchetto è valido
+        accept_STCS( packetData );
+
+        break;
+
+    }
+
+    if ( milliseconds >= trigger ) {
+        printf("No STCS has been received. Restart the program.\n");
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+}
+
+
+
+
+
+
+//! === ENCRYPTION KEY SENDING-RECEIVING SECTION ===
+void send_encryptionKey ( pcap_t *nicHandle ) {
+    //. funzione che genera ed invia la chiave di criptazione (+ il sale)
+
+    // genero la chiave di criptazione ed il sale ( la prima chiave della sessione ha numero 0 )
+    generate_encryptionKey( currentEncryption.key , ENCRYPTION_KEY_LEN );
+    generate_encryptionSalt( currentEncryption.salt );
+    currentEncryption.epoch = 0;
+    previousEncryption = currentEncryption;
+    bytesSinceRekey = 0;
+    lastRekeyClock = clock();
+
+
+
+    // invio la chiave di criptazione
+    u_char packet[500];
+    
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+    
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 4 ( per far confondere la chiave di criptazione con un messaggio criptato)
+    packet[14] = 0x04;
+
+    // copio la chiave di criptazione nel pacchetto
+    for ( int i=0 ; i<ENCRYPTION_KEY_LEN ; i++ )
+        packet[15+i] = currentEncryption.key[i];
+
+    // copio il sale nel pacchetto
+    for ( int i=0 ; i<ENCRYPTION_SALT_LEN ; i++ )
+        packet[15+ENCRYPTION_KEY_LEN+i] = currentEncryption.salt[i];
+
+    // accodo il pacchetto tra quelli di controllo
+    enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void accept_encryptionKey ( const u_char *packetData ) {
+    //. funzione che salva la chiave di criptazione (+ il sale) ricevuta nelle apposite variabili globali
+
+    // copio la chiave di criptazione nelle variabili globali
+    for ( int i=0 ; i<ENCRYPTION_KEY_LEN ; i++ )
+        currentEncryption.key[i] = packetData[15+i];
+    currentEncryption.key[ENCRYPTION_KEY_LEN] = '\0';
+
+    // copio il sale nelle variabili globali
+    for ( int i=0 ; i<ENCRYPTION_SALT_LEN ; i++ )
+        currentEncryption.salt[i] = packetData[15+ENCRYPTION_KEY_LEN+i];
+    currentEncryption.salt[ENCRYPTION_SALT_LEN] = '\0';
+
+    // la prima chiave della sessione ha numero 0
+    currentEncryption.epoch = 0;
+    previousEncryption = currentEncryption;
+    bytesSinceRekey = 0;
+    lastRekeyClock = clock();
+
+}
+
+void receive_encryptionKey ( pcap_t *nicHandle ) {
+    //. funzione che attende la chiave di criptazione (+ il sale) e la salva nelle apposite variabili globali
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+
+    // variabili per un timer che interrompa l'ascolto dopo un certo tempo
+    int milliseconds = 0 , trigger = 10000; // 10 secondi
+    clock_t start = clock();
+
+    while ( ((readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0) && (milliseconds<trigger) ) {
+        if ( readingResult == 0 ) {
+            printf("Timeout expired. Restart the program.\n");
+            exit(1);
+        }
+
+        // aggiorno il timer
+        clock_t difference = clock() - start;
+        milliseconds = difference * 1000 / CLOCKS_PER_SEC;
+
+
+
+        //. controlli sulla validità del pacchetto
+        // controllo che il pacchetto sia di tipo messaggio
+        if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x04 )
+            continue;
+
+        // controllo che il pacchetto sia per me
+        if ( memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+            continue;
+
+        // controllo che il pacchetto sia stato inviato dal dispositivo scelto
+        if ( memcmp( packetData+6 , dsapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+            continue;
+
+
+
+        //. operazioni da eseguire se il pacchetto è valido
+        accept_encryptionKey( packetData );
+
+        break;
+
+    }
+
+    if ( milliseconds >= trigger ) {
+        printf("No encryption key has been received. Restart the program.\n");
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+}   
+
+
+
+
+
+
+//! === KEEPALIVE SECTION ===
+void write_packetTimestamp ( u_char *packetField , DWORD timestamp ) {
+    //. funzione che scrive un timestamp ( 4 byte, big endian ) in un pacchetto
+
+    for ( int i=0 ; i<4 ; i++ )
+        packetField[i] = ( timestamp >> ( 8 * (3-i) ) ) & 0xff;
+
+}
+
+DWORD read_packetTimestamp ( const u_char *packetField ) {
+    //. funzione che legge un timestamp ( 4 byte, big endian ) da un pacchetto
+
+    DWORD timestamp = 0;
+    for ( int i=0 ; i<4 ; i++ )
+        timestamp = ( timestamp << 8 ) | packetField[i];
+
+    return timestamp;
+
+}
+
+void write_timestamps ( u_char *packetFields ) {
+    //. funzione che scrive nel pacchetto il mio timestamp e l'eco dell'ultimo timestamp dell'interlocutore
+
+    EnterCriticalSection( &keepaliveLock );
+
+    DWORD now = GetTickCount();
+    write_packetTimestamp( packetFields , now ? now : 1 ); // 0 significa "nessun timestamp"
+
+    // l'eco viene spostato in avanti del tempo passato dalla ricezione, così misura solo il viaggio
+    DWORD echo = 0;
+    if ( keepalive.peerTimestamp != 0 ) {
+        echo = keepalive.peerTimestamp + ( now - keepalive.peerTimestampTick );
+        keepalive.peerTimestamp = 0; // ogni timestamp viene restituito una sola volta
+    }
+    write_packetTimestamp( packetFields+4 , echo );
+
+    LeaveCriticalSection( &keepaliveLock );
+
+}
+
+void update_rttEstimate ( double rttSample ) {
+    //. funzione che aggiorna RTT medio, variazione e timeout di ritrasmissione con una nuova misura ( come in RFC 6298 )
+
+    if ( keepalive.rttMeasured == FALSE ) {
+        keepalive.smoothedRtt = rttSample;
+        keepalive.rttVariation = rttSample / 2;
+        keepalive.rttMeasured = TRUE;
+    }
+    else {
+        double difference = keepalive.smoothedRtt - rttSample;
+        keepalive.rttVariation = 0.75 * keepalive.rttVariation + 0.25 * ( difference < 0 ? -difference : difference );
+        keepalive.smoothedRtt = 0.875 * keepalive.smoothedRtt + 0.125 * rttSample;
+    }
+    keepalive.rttSamples++;
+
+    keepalive.retransmitTimeout = keepalive.smoothedRtt + 4 * keepalive.rttVariation;
+    if ( keepalive.retransmitTimeout < RTO_MIN )
+        keepalive.retransmitTimeout = RTO_MIN;
+    if ( keepalive.retransmitTimeout > RTO_MAX )
+        keepalive.retransmitTimeout = RTO_MAX;
+
+}
+
+void read_timestamps ( const u_char *packetFields ) {
+    //. funzione che legge timestamp ed eco da un pacchetto dell'interlocutore: l'eco fornisce una misura del RTT
+
+    DWORD timestamp = read_packetTimestamp( packetFields );
+    DWORD echo = read_packetTimestamp( packetFields+4 );
+
+    EnterCriticalSection( &keepaliveLock );
+
+    DWORD now = GetTickCount();
+    if ( echo != 0 && now - echo <= RTO_MAX * 6 ) // scarto gli echi assurdi ( ad esempio di una sessione precedente )
+        update_rttEstimate( now - echo );
+
+    if ( timestamp != 0 ) {
+        keepalive.peerTimestamp = timestamp;
+        keepalive.peerTimestampTick = now;
+    }
+
+    LeaveCriticalSection( &keepaliveLock );
+
+}
+
+void note_peerActivity () {
+    //. funzione che registra che l'interlocutore è vivo ( ogni suo pacchetto vale come risposta ad un ping )
+
+    EnterCriticalSection( &keepaliveLock );
+    keepalive.lastHeardTick = GetTickCount();
+    keepalive.pingOutstanding = FALSE;
+    keepalive.missedPongs = 0;
+    LeaveCriticalSection( &keepaliveLock );
+
+}
+
+DWORD get_retransmitTimeout () {
+    //. funzione che restituisce il timeout di ritrasmissione corrente in millisecondi
+
+    EnterCriticalSection( &keepaliveLock );
+    DWORD retransmitTimeout = (DWORD) keepalive.retransmitTimeout;
+    LeaveCriticalSection( &keepaliveLock );
+
+    return retransmitTimeout;
+
+}
+
+void send_keepalivePacket ( pcap_t *nicHandle , u_char packetType ) {
+    //. funzione che invia un ping ( 0x12 ) o un pong ( 0x13 ) con timestamp ed eco
+
+    u_char packet[60]; // dimensione minima di un pacchetto Ethernet
+    memset( packet , 0 , 60 );
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte al tipo del pacchetto
+    packet[14] = packetType;
+
+    // setto timestamp ed eco
+    write_timestamps( packet+15 );
+
+    // accodo il pacchetto tra quelli di controllo, così il RTT non comprende l'attesa dietro ai blocchi dei file;
+    // il pong viene inviato dal thread di ricezione, che non può attendere che la coda si liberi
+    if ( packetType == 0x13 )
+        try_enqueuePacket( nicHandle , packet , 60 , TRANSMIT_CONTROL );
+    else
+        enqueue_packet( nicHandle , packet , 60 , TRANSMIT_CONTROL );
+
+}
+
+void end_session ( const char *reason ) {
+    //. funzione che termina la sessione: il programma interattivo si chiude, il daemon torna disponibile per una nuova sessione
+
+    if ( daemonMode ) {
+        EnterCriticalSection( &daemonLock );
+        sessionHandle = NULL;
+        LeaveCriticalSection( &daemonLock );
+        printf( "%s\n" , reason );
+        return;
+    }
+
+    terminal_printf( "---\n%s\n---" , reason );
+    Sleep(10000); // 10 secondi
+    exit(0);
+
+}
+
+boolean move_sessionLink ( int linkIndex ) {
+    //. funzione che sposta chat, conferme e pacchetti di controllo su un altro link abbinato ( il primo funzionante se linkIndex è -1, FALSE se non ce n'è )
+
+    EnterCriticalSection( &transmitLock );
+
+    if ( linkIndex == sessionLink ) {
+        LeaveCriticalSection( &transmitLock );
+        return TRUE;
+    }
+    for ( int i=0 ; i<stripeLinksCount && linkIndex<0 ; i++ )
+        if ( i != sessionLink && stripeLinks[i].up )
+            linkIndex = i;
+    if ( linkIndex < 0 ) {
+        LeaveCriticalSection( &transmitLock );
+        return FALSE;
+    }
+
+    // il link caduto non riceve più blocchi, e la sessione usa i MAC del nuovo link
+    stripeLinks[sessionLink].up = FALSE;
+    sessionLink = linkIndex;
+    ssapAddress = stripeLinks[linkIndex].localAddress;
+    dsapAddress = stripeLinks[linkIndex].peerAddress;
+    sessionHandle = stripeLinks[linkIndex].nicHandle;
+
+    // i pacchetti ancora in coda partono dal nuovo link ( quelli che lo scheduler sta già inviando sono persi )
+    for ( int c=0 ; c<TRANSMIT_CLASSES ; c++ )
+        for ( int p=transmitQueues[c].sending ; p<transmitQueues[c].count ; p++ )
+            rehome_queuedPacket( &transmitQueues[c].slots[( transmitQueues[c].head + p ) % TRANSMIT_QUEUE_LEN] );
+
+    LeaveCriticalSection( &transmitLock );
+
+    // i ping persi sul vecchio link non contano per il nuovo
+    EnterCriticalSection( &keepaliveLock );
+    keepalive.pingOutstanding = FALSE;
+    keepalive.missedPongs = 0;
+    LeaveCriticalSection( &keepaliveLock );
+
+    terminal_printf( "The NIC of the conversation stopped working, the conversation continues on another NIC" );
+    return TRUE;
+
+}
+
+void check_keepalive ( pcap_t *nicHandle ) {
+    //. funzione che invia un ping se l'interlocutore tace da troppo tempo e chiude la sessione se non risponde più
+
+    if ( sessionHandle == NULL )
+        return;
+
+    EnterCriticalSection( &keepaliveLock );
+
+    DWORD now = GetTickCount();
+
+    // l'interlocutore ha inviato qualcosa di recente: non serve nessun ping
+    if ( now - keepalive.lastHeardTick < KEEPALIVE_IDLE_INTERVAL ) {
+        LeaveCriticalSection( &keepaliveLock );
+        return;
+    }
+
+    // il ping precedente non ha ancora avuto risposta, ma il tempo per rispondere non è finito
+    if ( keepalive.pingOutstanding && now - keepalive.pingTick < (DWORD) keepalive.retransmitTimeout ) {
+        LeaveCriticalSection( &keepaliveLock );
+        return;
+    }
+
+    // il ping precedente è rimasto senza risposta
+    if ( keepalive.pingOutstanding )
+        keepalive.missedPongs++;
+
+    // prima di chiudere la sessione provo a continuarla su un'altra NIC abbinata
+    if ( keepalive.missedPongs >= KEEPALIVE_MAX_MISSED ) {
+        LeaveCriticalSection( &keepaliveLock );
+        if ( move_sessionLink( -1 ) == FALSE )
+            end_session( "The other device is not responding: the connection has been lost." );
+        return;
+    }
+
+    keepalive.pingOutstanding = TRUE;
+    keepalive.pingTick = now;
+
+    LeaveCriticalSection( &keepaliveLock );
+
+    send_keepalivePacket( nicHandle , 0x12 );
+
+}
+
+void print_keepaliveStats () {
+    //. funzione che stampa la stima del RTT e lo stato dei ping
+
+    EnterCriticalSection( &keepaliveLock );
+    if ( keepalive.rttMeasured )
+        print_statsLine( stdout , "RTT %.1f ms, jitter %.1f ms, retransmission timeout %.0f ms (%llu samples), unanswered pings %d" ,
+                keepalive.smoothedRtt , keepalive.rttVariation , keepalive.retransmitTimeout , keepalive.rttSamples , keepalive.missedPongs );
+    else
+        print_statsLine( stdout , "RTT not measured yet, retransmission timeout %.0f ms" , keepalive.retransmitTimeout );
+    LeaveCriticalSection( &keepaliveLock );
+
+}
+
+
+
+
+
+
+//! === REKEYING SECTION ===
+encryptionContext *find_encryptionContext ( u_char epoch ) {
+    //. funzione che restituisce la chiave con il numero specificato ( NULL se non la conosco )
+
+    if ( currentEncryption.epoch == epoch )
+        return &currentEncryption;
+    if ( rekeyPending && pendingEncryption.epoch == epoch )
+        return &pendingEncryption;
+    if ( previousEncryption.epoch == epoch )
+        return &previousEncryption;
+
+    return NULL;
+
+}
+
+void switch_encryptionContext ( encryptionContext *newEncryption ) {
+    //. funzione che mette in uso una nuova chiave, tenendo la vecchia per i messaggi ancora in viaggio
+
+    previousEncryption = currentEncryption;
+    currentEncryption = *newEncryption;
+
+    rekeyPending = FALSE;
+    bytesSinceRekey = 0;
+    lastRekeyClock = clock();
+
+}
+
+
+
+void build_rekeyPacket ( u_char *packet ) {
+    //. funzione che prepara la proposta della nuova chiave, criptata con quella corrente ( da chiamare con encryptionLock preso )
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 6 ( per far riconoscere la proposta di una nuova chiave )
+    packet[14] = 0x06;
+
+    // setto il numero della nuova chiave
+    packet[15] = pendingEncryption.epoch;
+
+    // copio la nuova chiave ed il nuovo sale nel pacchetto e li cripto con la chiave corrente
+    memcpy( packet+16 , pendingEncryption.key , ENCRYPTION_KEY_LEN );
+    memcpy( packet+16+ENCRYPTION_KEY_LEN , pendingEncryption.salt , ENCRYPTION_SALT_LEN );
+    encrypt_buffer( (char*) packet+16 , ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN , currentEncryption.key , currentEncryption.salt );
+
+}
+
+void send_rekeyAcknowledgement ( pcap_t *nicHandle , u_char epoch ) {
+    //. funzione che conferma all'interlocutore di aver messo in uso la nuova chiave
+
+    u_char packet[500];
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 7 ( per far riconoscere la conferma della nuova chiave )
+    packet[14] = 0x07;
+
+    // setto il numero della chiave confermata
+    packet[15] = epoch;
+
+    // copio il testo di conferma criptato con la nuova chiave: solo chi la possiede può produrlo
+    memcpy( packet+16 , REKEY_CONFIRMATION , strlen(REKEY_CONFIRMATION) );
+    encrypt_buffer( (char*) packet+16 , strlen(REKEY_CONFIRMATION) , currentEncryption.key , currentEncryption.salt );
+
+    // accodo il pacchetto tra quelli di controllo senza attendere: lo invia il thread di ricezione, ed una conferma persa fa ripetere la proposta
+    try_enqueuePacket( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+
+
+boolean prepare_rekeyProposal ( u_char *packet ) {
+    //. funzione che prepara una proposta quando la chiave corrente ha criptato troppi byte o è in uso da troppo tempo, o quando la
+    //. proposta precedente è rimasta senza conferma ( da chiamare con encryptionLock preso, TRUE se il pacchetto va accodato )
+
+    static clock_t proposalClock; // istante in cui è stata inviata l'ultima proposta
+
+    if ( rekeyInitiator == FALSE )
+        return FALSE;
+
+    // se la proposta è ancora senza conferma la ripeto ( il pacchetto potrebbe essere andato perso )
+    if ( rekeyPending ) {
+        if ( ( clock() - proposalClock ) * 1000 / CLOCKS_PER_SEC < get_retransmitTimeout() )
+            return FALSE;
+        build_rekeyPacket( packet );
+        proposalClock = clock();
+        return TRUE;
+    }
+
+    int milliseconds = ( clock() - lastRekeyClock ) * 1000 / CLOCKS_PER_SEC;
+    if ( bytesSinceRekey < REKEY_BYTES_TRIGGER && milliseconds < REKEY_TIME_TRIGGER )
+        return FALSE;
+
+    // genero la nuova chiave: fino alla conferma i messaggi continuano ad usare quella corrente
+    generate_encryptionKey( pendingEncryption.key , ENCRYPTION_KEY_LEN );
+    generate_encryptionSalt( pendingEncryption.salt );
+    pendingEncryption.epoch = currentEncryption.epoch + 1;
+    rekeyPending = TRUE;
+
+    build_rekeyPacket( packet );
+    proposalClock = clock();
+    return TRUE;
+
+}
+
+void check_rekeyTrigger ( pcap_t *nicHandle ) {
+    //. funzione eseguita periodicamente dal thread della connessione: avvia o ripete il cambio di chiave anche se il cMaster non scrive
+
+    // la chiave in uso viene sostituita per limitare quanto testo è criptato con la stessa chiave, non per segretezza:
+    // la prima chiave viaggia in chiaro ( send_encryptionKey ), quindi chi la cattura può seguire tutte le successive
+    u_char packet[500];
+    EnterCriticalSection( &encryptionLock );
+    boolean proposal = prepare_rekeyProposal( packet );
+    LeaveCriticalSection( &encryptionLock );
+
+    if ( proposal )
+        enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void receive_rekeyPacket ( pcap_t *nicHandle , const u_char *packetData ) {
+    //. funzione che mette in uso la chiave proposta dall'interlocutore e ne conferma la ricezione
+
+    u_char epoch = packetData[15];
+
+    // accetto solo la chiave successiva a quella corrente; se è già in uso la conferma è andata persa e la ripeto
+    if ( epoch == (u_char) ( currentEncryption.epoch + 1 ) ) {
+
+        encryptionContext newEncryption;
+
+        // decripto la nuova chiave ed il nuovo sale con la chiave corrente
+        char keyMaterial[ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN];
+        memcpy( keyMaterial , packetData+16 , ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN );
+        encrypt_buffer( keyMaterial , ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN , currentEncryption.key , currentEncryption.salt );
+
+        memcpy( newEncryption.key , keyMaterial , ENCRYPTION_KEY_LEN );
+        newEncryption.key[ENCRYPTION_KEY_LEN] = '\0';
+        memcpy( newEncryption.salt , keyMaterial+ENCRYPTION_KEY_LEN , ENCRYPTION_SALT_LEN );
+        newEncryption.salt[ENCRYPTION_SALT_LEN] = '\0';
+        newEncryption.epoch = epoch;
+
+        switch_encryptionContext( &newEncryption );
+
+    } else if ( epoch != currentEncryption.epoch ) {
+        return;
+    }
+
+    send_rekeyAcknowledgement( nicHandle , epoch );
+
+}
+
+void receive_rekeyAcknowledgement ( const u_char *packetData ) {
+    //. funzione che, ricevuta la conferma dell'interlocutore, mette in uso la nuova chiave
+
+    if ( rekeyPending == FALSE || packetData[15] != pendingEncryption.epoch )
+        return;
+
+    // controllo che l'interlocutore abbia criptato il testo di conferma con la nuova chiave
+    char confirmation[sizeof(REKEY_CONFIRMATION)];
+    memcpy( confirmation , packetData+16 , strlen(REKEY_CONFIRMATION) );
+    encrypt_buffer( confirmation , strlen(REKEY_CONFIRMATION) , pendingEncryption.key , pendingEncryption.salt );
+    if ( memcmp( confirmation , REKEY_CONFIRMATION , strlen(REKEY_CONFIRMATION) ) != 0 )
+        return;
+
+    switch_encryptionContext( &pendingEncryption );
+
+}
+
+
+
+
+
+
+//! === MULTI-NIC STRIPING SECTION ===
+void open_stripeLinks ( pcap_t *nicHandle , char *nicNames ) {
+    //. funzione che apre le NIC aggiuntive su cui distribuire i trasferimenti di file
+
+    // il link 0 è sempre la NIC principale, usata anche per la chat ed i pacchetti di controllo finché funziona
+    stripeLinks[0].nicHandle = nicHandle;
+    stripeLinks[0].localAddress = ssapAddress;
+    stripeLinks[0].peerAddress = dsapAddress;
+    stripeLinks[0].up = TRUE;
+    stripeLinksCount = 1;
+
+    // i nomi delle NIC aggiuntive sono separati da spazi
+    for ( char *nicName=strtok( nicNames , " \n" ) ; nicName && stripeLinksCount<STRIPE_MAX_LINKS ; nicName=strtok( NULL , " \n" ) ) {
+
+        // il timeout breve permette di alternare invio e ascolto durante l'abbinamento
+        char errorBuffer[PCAP_ERRBUF_SIZE+1];
+        pcap_t *linkHandle = pcap_open_live( nicName , 65536 , 1 , STRIPE_READ_TIMEOUT , errorBuffer );
+        if ( linkHandle == NULL ) {
+            fprintf( stderr , "Unable to open the adapter %s, it won't be used.\n" , nicName );
+            continue;
+        }
+
+        stripeLink *link = &stripeLinks[stripeLinksCount++];
+        memset( link , 0 , sizeof(stripeLink) );
+        link->nicHandle = linkHandle;
+        find_nicAddress( nicName , &link->localAddress );
+
+    }
+
+    // all'inizio tutti i link hanno la stessa capacità, poi viene misurata ad ogni invio
+    for ( int i=0 ; i<stripeLinksCount ; i++ ) {
+        stripeLinks[i].capacity = STRIPE_INITIAL_CAPACITY;
+        stripeLinks[i].capacityMeasured = FALSE;
+        stripeLinks[i].sendQueue = pcap_sendqueue_alloc( FILE_WINDOW_CHUNKS * ( FILE_PACKET_LEN + sizeof(packetHeader) ) );
+    }
+
+}
+
+void send_stripeHello ( stripeLink *link , boolean peerHeard ) {
+    //. funzione che annuncia sul link la sessione a cui appartiene
+
+    u_char packet[500];
+
+    // setto il DSAP a 0xFF ( non conosco ancora il MAC dell'interlocutore su questo link )
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = 0xff;
+
+    // setto il SSAP al MAC della NIC del link
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = link->localAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 16 ( per far riconoscere l'annuncio di un link )
+    packet[14] = 0x10;
+
+    // la sessione è identificata dai MAC delle NIC principali ( quelli del link 0, anche se la sessione è passata su un altro link )
+    memcpy( packet+15 , stripeLinks[0].localAddress.addressBytes , ETHER_ADDR_LEN );
+    memcpy( packet+21 , stripeLinks[0].peerAddress.addressBytes , ETHER_ADDR_LEN );
+
+    // comunico se ho già sentito l'interlocutore su questo link
+    packet[27] = peerHeard;
+
+    // un link che non riesce ad inviare viene semplicemente escluso
+    if ( pcap_sendpacket( link->nicHandle , packet , 500 ) != 0 )
+        link->up = FALSE;
+
+}
+
+int receive_stripeHello ( stripeLink *link , const u_char *packetData ) {
+    //. funzione che riconosce l'annuncio dell'interlocutore ( -1 se non lo è, altrimenti se l'interlocutore mi ha sentito )
+
+    // controllo che il pacchetto sia un annuncio della mia sessione inviato dall'interlocutore
+    if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x10 )
+        return -1;
+    if ( memcmp( packetData+15 , stripeLinks[0].peerAddress.addressBytes , ETHER_ADDR_LEN ) != 0 || memcmp( packetData+21 , stripeLinks[0].localAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+        return -1;
+
+    // il mittente è il MAC dell'interlocutore su questo link
+    memcpy( link->peerAddress.addressBytes , packetData+ETHER_ADDR_LEN , ETHER_ADDR_LEN );
+
+    return packetData[27];
+
+}
+
+void pair_stripeLinks () {
+    //. funzione che scopre il MAC dell'interlocutore su ogni NIC aggiuntiva
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+
+    boolean peerHeard[STRIPE_MAX_LINKS] = { FALSE };    // ho sentito l'interlocutore sul link
+    boolean heardByPeer[STRIPE_MAX_LINKS] = { FALSE };  // l'interlocutore mi ha sentito sul link
+
+    // variabili per un timer che interrompa l'abbinamento dopo un certo tempo
+    int milliseconds = 0 , trigger = STRIPE_HELLO_TIMEOUT;
+    clock_t start = clock();
+
+    while ( milliseconds < trigger ) {
+
+        boolean allPaired = TRUE;
+
+        for ( int i=1 ; i<stripeLinksCount ; i++ ) {
+
+            stripeLink *link = &stripeLinks[i];
+            if ( heardByPeer[i] && peerHeard[i] )
+                continue;
+            allPaired = FALSE;
+
+            send_stripeHello( link , peerHeard[i] );
+
+            // ascolto il link per al massimo STRIPE_READ_TIMEOUT millisecondi
+            while ( (readingResult=pcap_next_ex( link->nicHandle , &header , &packetData )) > 0 ) {
+                int helloResult = receive_stripeHello( link , packetData );
+                if ( helloResult < 0 )
+                    continue;
+                peerHeard[i] = TRUE;
+                heardByPeer[i] = heardByPeer[i] || helloResult;
+            }
+
+        }
+
+        if ( allPaired )
+            break;
+
+        // aggiorno il timer
+        clock_t difference = clock() - start;
+        milliseconds = difference * 1000 / CLOCKS_PER_SEC;
+
+    }
+
+    // i link su cui non ho sentito l'interlocutore non vengono usati
+    for ( int i=1 ; i<stripeLinksCount ; i++ ) {
+        stripeLinks[i].up = peerHeard[i];
+        if ( peerHeard[i] )
+            printf( "Striping file transfers over an additional NIC\n" );
+        else
+            printf( "No peer on an additional NIC, it won't be used\n" );
+    }
+
+}
+
+
+
+void update_stripeLinkCapacity ( stripeLink *link , unsigned long long sentBytes , double seconds ) {
+    //. funzione che aggiorna la capacità stimata di un link con il tempo speso dal driver ad inviare sentBytes byte
+
+    if ( seconds <= 0 || sentBytes == 0 )
+        return;
+
+    // la prima misura sostituisce la capacità ipotizzata, poi media mobile esponenziale dei byte al secondo
+    if ( link->capacityMeasured == FALSE ) {
+        link->capacity = sentBytes / seconds;
+        link->capacityMeasured = TRUE;
+    } else {
+        link->capacity = 0.8 * link->capacity + 0.2 * ( sentBytes / seconds );
+    }
+
+}
+
+DWORD WINAPI transmit_stripeLink ( void *data ) {
+    //. funzione eseguita dai thread che inviano i pacchetti accodati su un link e ne misurano la capacità
+
+    stripeLink *link = (stripeLink*) data;
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency( &frequency );
+
+    while (1) {
+
+        WaitForSingleObject( link->startEvent , INFINITE );
+
+        LARGE_INTEGER before , after;
+        QueryPerformanceCounter( &before );
+        u_int sentBytes = pcap_sendqueue_transmit( link->nicHandle , link->sendQueue , 0 );
+        QueryPerformanceCounter( &after );
+
+        // se il link non ha inviato tutto è caduto: i blocchi persi verranno reinviati sugli altri link
+        if ( sentBytes < link->sendQueue->len )
+            link->up = FALSE;
+        else
+            update_stripeLinkCapacity( link , sentBytes , (double) ( after.QuadPart - before.QuadPart ) / frequency.QuadPart );
+
+        SetEvent( link->doneEvent );
+
+    }
+
+}
+
+void start_stripeTransmitters () {
+    //. funzione che avvia ( una volta sola ) i thread che inviano i pacchetti sui link
+
+    static boolean stripeTransmittersStarted = FALSE;
+    if ( stripeTransmittersStarted )
+        return;
+
+    // il link 0 non ha un thread: i suoi blocchi passano dalla coda dei dati dello scheduler
+    for ( int i=1 ; i<stripeLinksCount ; i++ ) {
+
+        stripeLinks[i].startEvent = CreateEvent( NULL , FALSE , FALSE , NULL );
+        stripeLinks[i].doneEvent = CreateEvent( NULL , FALSE , FALSE , NULL );
+
+        DWORD threadID;
+        HANDLE threadHandle = CreateThread( NULL , 0 , transmit_stripeLink , (void*) &stripeLinks[i] , 0 , &threadID );
+        if ( stripeLinks[i].startEvent == NULL || stripeLinks[i].doneEvent == NULL || threadHandle == NULL ) {
+            fprintf( stderr , "Error creating the threads used to send files. Restart the program.\n" );
+            Sleep(10000); // 10 secondi
+            exit(1);
+        }
+
+    }
+
+    stripeTransmittersStarted = TRUE;
+
+}
+
+boolean transmit_stripedPackets ( u_char *packets , int packetsCount , int packetLength ) {
+    //. funzione che distribuisce i pacchetti sui link in proporzione alla loro capacità e li invia in parallelo ( FALSE se tutti i link sono caduti )
+
+    start_stripeTransmitters();
+
+    // la capacità della NIC principale è misurata come quella degli altri link: solo il tempo speso dal driver, letto dallo scheduler
+    EnterCriticalSection( &transmitLock );
+    unsigned long long primaryBytesBefore = transmitQueues[TRANSMIT_BULK].transmitBytes;
+    double primarySecondsBefore = transmitQueues[TRANSMIT_BULK].transmitSeconds;
+    LeaveCriticalSection( &transmitLock );
+
+    // svuoto le code dei link
+    for ( int i=0 ; i<stripeLinksCount ; i++ ) {
+        stripeLinks[i].sendQueue->len = 0;
+        stripeLinks[i].queuedBytes = 0;
+    }
+
+    for ( int p=0 ; p<packetsCount ; p++ ) {
+
+        u_char *packet = packets + p*packetLength;
+        int length = 25 + ( packet[23] << 8 | packet[24] );
+
+        // scelgo il link che finirebbe prima di inviare anche questo pacchetto
+        stripeLink *chosenLink = NULL;
+        double chosenFinish = 0;
+        for ( int i=0 ; i<stripeLinksCount ; i++ ) {
+            if ( stripeLinks[i].up == FALSE )
+                continue;
+            double finish = ( stripeLinks[i].queuedBytes + length ) / stripeLinks[i].capacity;
+            if ( chosenLink == NULL || finish < chosenFinish ) {
+                chosenLink = &stripeLinks[i];
+                chosenFinish = finish;
+            }
+        }
+        if ( chosenLink == NULL )
+            return FALSE;
+        stripePacketLinks[p] = chosenLink - stripeLinks;
+
+        // sul link il pacchetto va dal MAC della mia NIC a quello della NIC dell'interlocutore
+        memcpy( packet , chosenLink->peerAddress.addressBytes , ETHER_ADDR_LEN );
+        memcpy( packet+ETHER_ADDR_LEN , chosenLink->localAddress.addressBytes , ETHER_ADDR_LEN );
+
+        // sulla NIC principale i blocchi passano dallo scheduler, così non ritardano chat e pacchetti di controllo
+        if ( chosenLink == &stripeLinks[0] ) {
+            enqueue_packet( chosenLink->nicHandle , packet , length , TRANSMIT_BULK );
+        } else {
+            packetHeader queuedHeader;
+            memset( &queuedHeader , 0 , sizeof(queuedHeader) );
+            queuedHeader.caplen = queuedHeader.len = length;
+            pcap_sendqueue_queue( chosenLink->sendQueue , &queuedHeader , packet );
+        }
+        chosenLink->queuedBytes += length;
+
+    }
+
+    // faccio inviare le code ai thread dei link aggiuntivi
+    HANDLE doneEvents[STRIPE_MAX_LINKS];
+    int busyLinks = 0;
+    for ( int i=1 ; i<stripeLinksCount ; i++ ) {
+        if ( stripeLinks[i].queuedBytes == 0 )
+            continue;
+        SetEvent( stripeLinks[i].startEvent );
+        doneEvents[busyLinks++] = stripeLinks[i].doneEvent;
+    }
+
+    // attendo che lo scheduler abbia inviato i blocchi della NIC principale e ne aggiorno la capacità stimata
+    if ( stripeLinks[0].queuedBytes > 0 ) {
+        wait_transmitQueue( TRANSMIT_BULK , INFINITE );
+        EnterCriticalSection( &transmitLock );
+        unsigned long long primaryBytes = transmitQueues[TRANSMIT_BULK].transmitBytes - primaryBytesBefore;
+        double primarySeconds = transmitQueues[TRANSMIT_BULK].transmitSeconds - primarySecondsBefore;
+        LeaveCriticalSection( &transmitLock );
+        update_stripeLinkCapacity( &stripeLinks[0] , primaryBytes , primarySeconds );
+    }
+
+    // aspetto che i link aggiuntivi abbiano finito
+    if ( busyLinks > 0 )
+        WaitForMultipleObjects( busyLinks , doneEvents , TRUE , INFINITE );
+
+    // segnalo i link caduti durante l'invio
+    for ( int i=0 ; i<stripeLinksCount ; i++ )
+        if ( stripeLinks[i].queuedBytes > 0 && stripeLinks[i].up == FALSE )
+            terminal_printf( "A NIC stopped working, the transfer continues on the others" );
+
+    return TRUE;
+
+}
+
+void update_stripeLinksHealth ( unsigned long long firstOffset , int chunksCount , unsigned long long acknowledgedOffset ) {
+    //. funzione che conta blocchi confermati e persi di ogni link nell'ultimo gruppo ed esclude i link che non consegnano più nulla
+
+    boolean linkAcknowledged[STRIPE_MAX_LINKS] = { FALSE };
+    int firstMissingLink = -1;
+
+    // la conferma è cumulativa: i blocchi prima dell'offset confermato sono arrivati, tutti quelli dopo vengono reinviati e contano come persi
+    // per il loro link ( se non arriva nessuna conferma l'offset è quello del gruppo ). Solo il primo perso ha certamente interrotto la sequenza:
+    // i successivi potrebbero essere arrivati, quindi solo il suo link conta un gruppo senza consegne
+    for ( int i=0 ; i<chunksCount ; i++ ) {
+        int linkIndex = stripePacketLinks[i];
+        if ( firstOffset + (unsigned long long) i * FILE_CHUNK_LEN < acknowledgedOffset ) {
+            stripeLinks[linkIndex].ackedChunks++;
+            linkAcknowledged[linkIndex] = TRUE;
+        } else {
+            stripeLinks[linkIndex].lostChunks++;
+            if ( firstMissingLink < 0 )
+                firstMissingLink = linkIndex;
+        }
+    }
+
+    for ( int i=0 ; i<stripeLinksCount ; i++ )
+        if ( linkAcknowledged[i] )
+            stripeLinks[i].silentWindows = 0;
+
+    if ( firstMissingLink < 0 )
+        return;
+
+    stripeLink *link = &stripeLinks[firstMissingLink];
+    if ( linkAcknowledged[firstMissingLink] == FALSE )
+        link->silentWindows++;
+
+    // il link della sessione porta anche le conferme: se smette di funzionare è il keepalive a spostare la sessione su un altro link
+    if ( firstMissingLink != sessionLink && link->up && link->silentWindows >= STRIPE_MAX_SILENT_WINDOWS ) {
+        link->up = FALSE;
+        terminal_printf( "A NIC hasn't delivered any block for %d windows, the transfer continues on the others" , STRIPE_MAX_SILENT_WINDOWS );
+    }
+
+}
+
+void print_stripeStats () {
+    //. funzione che stampa stato, capacità stimata e blocchi confermati e persi di ogni link
+
+    if ( stripeLinksCount == 1 )
+        return;
+
+    for ( int i=0 ; i<stripeLinksCount ; i++ )
+        print_statsLine( stdout , "NIC %d %-4s %.2f MB/s, blocks acknowledged %llu, lost %llu" , i , stripeLinks[i].up ? "up" : "down" ,
+                stripeLinks[i].capacity / ( 1024 * 1024 ) , stripeLinks[i].ackedChunks , stripeLinks[i].lostChunks );
+
+}
+
+
+
+
+
+
+//! === FILE TRANSFER SECTION ===
+void write_packetOffset ( u_char *packetField , unsigned long long offset ) {
+    //. funzione che scrive un offset a 64 bit nel pacchetto ( big endian )
+
+    for ( int i=0 ; i<8 ; i++ )
+        packetField[i] = ( offset >> ( 8 * (7-i) ) ) & 0xff;
+
+}
+
+unsigned long long read_packetOffset ( const u_char *packetField ) {
+    //. funzione che legge un offset a 64 bit dal pacchetto ( big endian )
+
+    unsigned long long offset = 0;
+    for ( int i=0 ; i<8 ; i++ )
+        offset = ( offset << 8 ) | packetField[i];
+
+    return offset;
+
+}
+
+
+
+void build_fileChunkPacket ( u_char *packet , const u_char *fileData , unsigned long long fileSize , unsigned long long offset , encryptionContext *fileEncryption ) {
+    //. funzione che costruisce il pacchetto che trasporta il blocco del file che inizia all'offset specificato
+
+    int chunkLength = ( fileSize - offset < FILE_CHUNK_LEN ) ? (int) ( fileSize - offset ) : FILE_CHUNK_LEN;
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 10 ( per far riconoscere il blocco di un file )
+    packet[14] = 0x0a;
+
+    // setto l'offset e la lunghezza del blocco
+    write_packetOffset( packet+15 , offset );
+    packet[23] = chunkLength >> 8;
+    packet[24] = chunkLength & 0xff;
+
+    // copio il blocco dal file mappato e lo cripto ( ogni blocco inizia all'inizio della chiave e del sale )
+    memcpy( packet+25 , fileData+offset , chunkLength );
+    encrypt_buffer( (char*) packet+25 , chunkLength , fileEncryption->key , fileEncryption->salt );
+
+}
+
+DWORD WINAPI fileEncryption_worker ( void *data ) {
+    //. funzione eseguita dai thread che costruiscono e criptano in parallelo i blocchi di un gruppo
+
+    int workerIndex = (int) (intptr_t) data;
+
+    while (1) {
+
+        // attendo che il thread principale prepari un nuovo gruppo di blocchi
+        WaitForSingleObject( fileWorkersStartEvents[workerIndex] , INFINITE );
+
+        // ogni thread si occupa di un blocco ogni FILE_WORKERS
+        for ( int i=workerIndex ; i<fileBatch.chunksCount ; i+=FILE_WORKERS )
+            build_fileChunkPacket( fileBatch.packets + i*FILE_PACKET_LEN , fileBatch.fileData , fileBatch.fileSize , fileBatch.firstOffset + (unsigned long long) i*FILE_CHUNK_LEN , &fileBatch.encryption );
+
+        SetEvent( fileWorkersDoneEvents[workerIndex] );
+
+    }
+
+}
+
+void start_fileWorkers () {
+    //. funzione che avvia ( una volta sola ) i thread che criptano i blocchi dei file
+
+    static boolean fileWorkersStarted = FALSE;
+    if ( fileWorkersStarted )
+        return;
+
+    for ( int i=0 ; i<FILE_WORKERS ; i++ ) {
+
+        fileWorkersStartEvents[i] = CreateEvent( NULL , FALSE , FALSE , NULL );
+        fileWorkersDoneEvents[i] = CreateEvent( NULL , FALSE , FALSE , NULL );
+
+        DWORD threadID;
+        HANDLE threadHandle = CreateThread( NULL , 0 , fileEncryption_worker , (void*) (intptr_t) i , 0 , &threadID );
+        if ( fileWorkersStartEvents[i] == NULL || fileWorkersDoneEvents[i] == NULL || threadHandle == NULL ) {
+            fprintf( stderr , "Error creating the threads used to encrypt files. Restart the program.\n" );
+            Sleep(10000); // 10 secondi
+            exit(1);
+        }
+
+    }
+
+    fileWorkersStarted = TRUE;
+
+}
+
+
+
+void send_fileOffer ( pcap_t *nicHandle , char *fileName , unsigned long long fileSize , encryptionContext *fileEncryption ) {
+    //. funzione che propone all'interlocutore l'invio di un file
+
+    u_char packet[500];
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 8 ( per far riconoscere la proposta di un file )
+    packet[14] = 0x08;
+
+    // setto il numero della chiave con cui verrà criptato il file e la dimensione del file
+    packet[15] = fileEncryption->epoch;
+    write_packetOffset( packet+16 , fileSize );
+
+    // copio il nome del file ( criptato ) nel pacchetto
+    int fileNameLength = strlen( fileName );
+    if ( fileNameLength > FILE_NAME_LEN )
+        fileNameLength = FILE_NAME_LEN;
+    packet[24] = fileNameLength;
+    memcpy( packet+25 , fileName , fileNameLength );
+    encrypt_buffer( (char*) packet+25 , fileNameLength , fileEncryption->key , fileEncryption->salt );
+
+    // accodo il pacchetto tra quelli di controllo, che vengono inviati prima di tutti gli altri
+    enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void send_fileAcknowledgement ( pcap_t *nicHandle , unsigned long long acknowledgedOffset ) {
+    //. funzione che comunica all'interlocutore fino a quale offset il file è stato ricevuto senza buchi
+
+    u_char packet[500];
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 9 ( per far riconoscere la conferma di ricezione di un file )
+    packet[14] = 0x09;
+
+    // setto l'offset confermato
+    write_packetOffset( packet+15 , acknowledgedOffset );
+
+    // accodo il pacchetto tra quelli di controllo senza attendere: lo invia il thread di ricezione, ed una conferma persa fa ripetere i blocchi
+    try_enqueuePacket( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void send_fileEnd ( pcap_t *nicHandle , unsigned long long finalOffset ) {
+    //. funzione che comunica all'interlocutore la fine del trasferimento, così non deve attendere altri blocchi
+
+    u_char packet[500];
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 17 ( per far riconoscere la fine del trasferimento )
+    packet[14] = 0x11;
+
+    // setto l'ultimo offset confermato
+    write_packetOffset( packet+15 , finalOffset );
+
+    // accodo il pacchetto tra quelli di controllo, che vengono inviati prima di tutti gli altri
+    enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void post_fileAcknowledgement ( const u_char *packetData ) {
+    //. funzione con cui il thread di ricezione consegna una conferma al thread che sta inviando il file
+
+    EnterCriticalSection( &receptionLock );
+    fileAcknowledgedOffset = read_packetOffset( packetData+15 );
+    LeaveCriticalSection( &receptionLock );
+
+    SetEvent( fileAcknowledgementEvent );
+
+}
+
+boolean receive_fileAcknowledgement ( int trigger , unsigned long long *acknowledgedOffset ) {
+    //. funzione che attende la conferma di ricezione dell'interlocutore per al massimo trigger millisecondi
+
+    if ( WaitForSingleObject( fileAcknowledgementEvent , trigger ) != WAIT_OBJECT_0 )
+        return FALSE;
+
+    EnterCriticalSection( &receptionLock );
+    *acknowledgedOffset = fileAcknowledgedOffset;
+    LeaveCriticalSection( &receptionLock );
+
+    return TRUE;
+
+}
+
+
+
+void send_file ( pcap_t *nicHandle , char *filePath ) {
+    //. funzione che invia un file mappandolo in memoria e criptandone i blocchi in parallelo
+
+    // apro il file e lo mappo in memoria
+    HANDLE fileHandle = CreateFile( filePath , GENERIC_READ , FILE_SHARE_READ , NULL , OPEN_EXISTING , FILE_ATTRIBUTE_NORMAL , NULL );
+    LARGE_INTEGER fileSizeStorage;
+    if ( fileHandle == INVALID_HANDLE_VALUE || GetFileSizeEx( fileHandle , &fileSizeStorage ) == 0 ) {
+        terminal_printf( "Error: unable to open %s." , filePath );
+        if ( fileHandle != INVALID_HANDLE_VALUE )
+            CloseHandle( fileHandle );
+        return;
+    }
+    unsigned long long fileSize = fileSizeStorage.QuadPart;
+
+    // un file vuoto non può essere mappato, ma basta la proposta per crearlo dall'altra parte
+    HANDLE mappingHandle = NULL;
+    const u_char *fileData = NULL;
+    if ( fileSize > 0 ) {
+        mappingHandle = CreateFileMapping( fileHandle , NULL , PAGE_READONLY , 0 , 0 , NULL );
+        if ( mappingHandle != NULL )
+            fileData = (const u_char*) MapViewOfFile( mappingHandle , FILE_MAP_READ , 0 , 0 , 0 );
+        if ( fileData == NULL ) {
+            terminal_printf( "Error: unable to map %s in memory." , filePath );
+            if ( mappingHandle != NULL )
+                CloseHandle( mappingHandle );
+            CloseHandle( fileHandle );
+            return;
+        }
+    }
+
+    // il nome inviato è solo l'ultima parte del percorso
+    char *fileName = filePath;
+    for ( char *c=filePath ; *c ; c++ )
+        if ( *c == '\\' || *c == '/' )
+            fileName = c+1;
+
+    // il file viene criptato tutto con la chiave corrente, anche se nel frattempo la chiave cambia
+    EnterCriticalSection( &encryptionLock );
+    encryptionContext fileEncryption = currentEncryption;
+    LeaveCriticalSection( &encryptionLock );
+
+    // scarto le conferme rimaste da un trasferimento precedente
+    ResetEvent( fileAcknowledgementEvent );
+
+
+
+    //. proposta del file: l'interlocutore risponde con l'offset da cui riprendere
+    unsigned long long acknowledgedOffset = 0;
+    boolean offerAccepted = FALSE;
+    for ( int attempt=0 ; attempt<FILE_MAX_RETRIES && offerAccepted == FALSE ; attempt++ ) {
+        send_fileOffer( nicHandle , fileName , fileSize , &fileEncryption );
+        offerAccepted = receive_fileAcknowledgement( get_retransmitTimeout() , &acknowledgedOffset );
+    }
+
+
+
+    //. invio dei blocchi, un gruppo di FILE_WINDOW_CHUNKS blocchi alla volta
+    start_fileWorkers();
+    fileBatch.packets = (u_char*) malloc( FILE_WINDOW_CHUNKS * FILE_PACKET_LEN );
+    if ( fileBatch.packets == NULL ) {
+        fprintf( stderr , "Error allocating the packets of the file. Restart the program.\n" );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+    fileBatch.fileData = fileData;
+    fileBatch.fileSize = fileSize;
+    fileBatch.encryption = fileEncryption;
+
+    unsigned long long startingOffset = acknowledgedOffset;
+    clock_t start = clock();
+    int retries = 0;
+
+    while ( offerAccepted && acknowledgedOffset < fileSize && retries < FILE_MAX_RETRIES ) {
+
+        // preparo il gruppo che parte dall'ultimo offset confermato ( i blocchi persi vengono reinviati )
+        unsigned long long remainingChunks = ( fileSize - acknowledgedOffset + FILE_CHUNK_LEN - 1 ) / FILE_CHUNK_LEN;
+        fileBatch.firstOffset = acknowledgedOffset;
+        fileBatch.chunksCount = ( remainingChunks < FILE_WINDOW_CHUNKS ) ? (int) remainingChunks : FILE_WINDOW_CHUNKS;
+
+        // faccio costruire e criptare i blocchi ai thread e aspetto che abbiano finito
+        for ( int i=0 ; i<FILE_WORKERS ; i++ )
+            SetEvent( fileWorkersStartEvents[i] );
+        WaitForMultipleObjects( FILE_WORKERS , fileWorkersDoneEvents , TRUE , INFINITE );
+
+        // distribuisco i pacchetti sulle NIC della sessione ed invio l'intero gruppo ( se tutte le NIC sono cadute mi fermo )
+        if ( transmit_stripedPackets( fileBatch.packets , fileBatch.chunksCount , FILE_PACKET_LEN ) == FALSE )
+            break;
+
+        // attendo la conferma: se non arriva reinvio il gruppo
+        unsigned long long newOffset;
+        if ( receive_fileAcknowledgement( get_retransmitTimeout() , &newOffset ) && newOffset > acknowledgedOffset ) {
+            acknowledgedOffset = newOffset;
+            retries = 0;
+        } else {
+            retries++;
+        }
+
+        // la conferma dice anche quali link stanno consegnando i blocchi
+        update_stripeLinksHealth( fileBatch.firstOffset , fileBatch.chunksCount , acknowledgedOffset );
+
+    }
+
+    // comunico all'interlocutore che il trasferimento è finito ( completato o interrotto )
+    if ( offerAccepted )
+        send_fileEnd( nicHandle , acknowledgedOffset );
+
+    // anche i byte del file consumano la chiave corrente
+    EnterCriticalSection( &encryptionLock );
+    if ( fileEncryption.epoch == currentEncryption.epoch )
+        bytesSinceRekey += acknowledgedOffset - startingOffset;
+    LeaveCriticalSection( &encryptionLock );
+
+
+
+    //. stampo l'esito del trasferimento
+    double seconds = (double) ( clock() - start ) / CLOCKS_PER_SEC;
+    double megabytes = (double) ( acknowledgedOffset - startingOffset ) / ( 1024 * 1024 );
+    if ( offerAccepted && acknowledgedOffset >= fileSize )
+        terminal_printf( "File %s sent: %.2f MB in %.2f s (%.2f MB/s)" , fileName , megabytes , seconds , seconds > 0 ? megabytes / seconds : 0 );
+    else
+        terminal_printf( "Transfer of %s interrupted at %llu of %llu bytes. Send it again to resume." , fileName , acknowledgedOffset , fileSize );
+
+    // libero le risorse
+    free( fileBatch.packets );
+    if ( fileData != NULL )
+        UnmapViewOfFile( fileData );
+    if ( mappingHandle != NULL )
+        CloseHandle( mappingHandle );
+    CloseHandle( fileHandle );
+
+}
+
+
+DWORD WINAPI send_fileThread ( void *data ) {
+    //. funzione eseguita dal thread che invia un file mentre l'utente continua a scrivere
+
+    pcap_t *nicHandle = (pcap_t*) data;
+
+    send_file( nicHandle , fileSendingPath );
+    InterlockedExchange( &fileSending , FALSE );
+
+    return 0;
+
+}
+
+void start_fileSending ( pcap_t *nicHandle , char *filePath ) {
+    //. funzione che avvia l'invio di un file in sottofondo ( un file alla volta )
+
+    if ( InterlockedCompareExchange( &fileSending , TRUE , FALSE ) != FALSE ) {
+        terminal_printf("A file is already being sent, wait for it to finish.");
+        return;
+    }
+
+    strncpy( fileSendingPath , filePath , sizeof(fileSendingPath)-1 );
+    fileSendingPath[sizeof(fileSendingPath)-1] = '\0';
+
+    DWORD threadID;
+    HANDLE threadHandle = CreateThread( NULL , 0 , send_fileThread , (void*) nicHandle , 0 , &threadID );
+    if ( threadHandle == NULL ) {
+        terminal_printf( "Error creating the thread used to send the file." );
+        InterlockedExchange( &fileSending , FALSE );
+    }
+
+}
+
+
+
+boolean read_filePartInfo ( char *partPath , unsigned long long fileSize , unsigned long long *resumeOffset ) {
+    //. funzione che legge da quale offset riprendere un file interrotto ( FALSE se non c'è un .part della stessa dimensione )
+
+    *resumeOffset = 0;
+    FILE *partFile = fopen( partPath , "rb" );
+    if ( partFile == NULL )
+        return FALSE;
+
+    // il file .part contiene la dimensione del file e l'offset confermato
+    u_char partInfo[16];
+    boolean matching = FALSE;
+    if ( fread( partInfo , 1 , 16 , partFile ) == 16 && read_packetOffset( partInfo ) == fileSize && read_packetOffset( partInfo+8 ) <= fileSize ) {
+        *resumeOffset = read_packetOffset( partInfo+8 );
+        matching = TRUE;
+    }
+    fclose( partFile );
+
+    return matching;
+
+}
+
+void write_filePartInfo ( char *partPath , unsigned long long fileSize , unsigned long long acknowledgedOffset ) {
+    //. funzione che salva fino a quale offset il file è stato ricevuto, per poter riprendere dopo un'interruzione
+
+    FILE *partFile = fopen( partPath , "wb" );
+    if ( partFile == NULL )
+        return;
+
+    u_char partInfo[16];
+    write_packetOffset( partInfo , fileSize );
+    write_packetOffset( partInfo+8 , acknowledgedOffset );
+    fwrite( partInfo , 1 , 16 , partFile );
+    fclose( partFile );
+
+}
+
+void store_fileChunk ( const u_char *packetData , int capturedLength ) {
+    //. funzione che scrive un blocco ricevuto ( da qualsiasi NIC ) nel file mappato e rimette in ordine i blocchi
+
+    boolean acknowledgementDue = FALSE , partInfoDue = FALSE;
+    unsigned long long acknowledgedOffset , fileSize;
+    char partPath[FILE_PATH_LEN];
+
+    EnterCriticalSection( &receptionLock );
+    fileReception *reception = &fileReceptionState;
+
+    unsigned long long chunkOffset = read_packetOffset( packetData+15 );
+    int chunkLength = packetData[23] << 8 | packetData[24];
+
+    // controllo che il blocco sia valido: l'offset fa da numero di sequenza
+    if ( reception->active == FALSE || chunkOffset % FILE_CHUNK_LEN != 0 || chunkOffset >= reception->fileSize || capturedLength < 25 + chunkLength ) {
+        LeaveCriticalSection( &receptionLock );
+        return;
+    }
+    unsigned long long remainingBytes = reception->fileSize - chunkOffset;
+    if ( chunkLength != ( remainingBytes < FILE_CHUNK_LEN ? (int) remainingBytes : FILE_CHUNK_LEN ) ) {
+        LeaveCriticalSection( &receptionLock );
+        return;
+    }
+
+    if ( chunkOffset < reception->expectedOffset || chunkOffset >= reception->expectedOffset + (unsigned long long) FILE_WINDOW_CHUNKS * FILE_CHUNK_LEN ) {
+
+        // blocco già ricevuto o fuori dal gruppo: la conferma potrebbe essere andata persa, la ripeto ( al più una volta ogni FILE_ACK_INTERVAL millisecondi )
+        if ( ( clock() - reception->lastAcknowledgementClock ) * 1000 / CLOCKS_PER_SEC >= FILE_ACK_INTERVAL )
+            acknowledgementDue = TRUE;
+
+    } else {
+
+        // i blocchi arrivano fuori ordine dalle diverse NIC: ricordo quali ho già dopo quello atteso
+        int chunkIndex = ( chunkOffset - reception->expectedOffset ) / FILE_CHUNK_LEN;
+        if ( ( reception->receivedMask & ( 1ULL << chunkIndex ) ) == 0 ) {
+
+            // decripto il blocco direttamente nel file mappato
+            memcpy( reception->fileData+chunkOffset , packetData+25 , chunkLength );
+            encrypt_buffer( (char*) reception->fileData+chunkOffset , chunkLength , reception->encryption.key , reception->encryption.salt );
+            reception->receivedMask |= 1ULL << chunkIndex;
+            reception->lastChunkClock = clock();
+
+            // avanzo finché i blocchi sono contigui
+            unsigned long long previousOffset = reception->expectedOffset;
+            while ( reception->receivedMask & 1 ) {
+                remainingBytes = reception->fileSize - reception->expectedOffset;
+                reception->expectedOffset += remainingBytes < FILE_CHUNK_LEN ? remainingBytes : FILE_CHUNK_LEN;
+                reception->receivedMask >>= 1;
+            }
+
+            // confermo la ricezione alla fine di ogni gruppo e alla fine del file: i gruppi del mittente partono dall'ultima conferma,
+            // quindi la fine del gruppo si misura da lì e non da un multiplo di FILE_WINDOW_CHUNKS ( dopo una ripresa non sono allineati )
+            if ( previousOffset != reception->expectedOffset && ( reception->expectedOffset - reception->acknowledgedOffset >= (unsigned long long) FILE_WINDOW_CHUNKS * FILE_CHUNK_LEN
+                                                                  || reception->expectedOffset == reception->fileSize ) ) {
+                acknowledgementDue = TRUE;
+                partInfoDue = TRUE;
+            }
+
+        }
+
+    }
+
+    if ( acknowledgementDue ) {
+        reception->lastAcknowledgementClock = clock();
+        reception->acknowledgedOffset = reception->expectedOffset;
+    }
+    acknowledgedOffset = reception->expectedOffset;
+    fileSize = reception->fileSize;
+    if ( partInfoDue )
+        strcpy( partPath , reception->partPath );
+    pcap_t *nicHandle = reception->nicHandle;
+    LeaveCriticalSection( &receptionLock );
+
+    // il file .part viene scritto fuori dalla sezione critica, così le altre NIC non attendono il disco;
+    // viene scritto prima della conferma, quindi l'ultimo è sempre salvato prima che il mittente chiuda il trasferimento
+    if ( partInfoDue )
+        write_filePartInfo( partPath , fileSize , acknowledgedOffset );
+
+    // le conferme viaggiano sul link della sessione
+    if ( acknowledgementDue )
+        send_fileAcknowledgement( nicHandle , acknowledgedOffset );
+
+}
+
+boolean check_receivedFileName ( const char *fileName ) {
+    //. funzione che controlla che il nome scelto dall'interlocutore sia un semplice nome di file, utilizzabile solo nella cartella dei download
+
+    int fileNameLength = strlen( fileName );
+    if ( fileNameLength == 0 || strcmp( fileName , "." ) == 0 || strcmp( fileName , ".." ) == 0 )
+        return FALSE;
+
+    // niente percorsi, caratteri non ammessi da Windows o caratteri di controllo
+    for ( int i=0 ; i<fileNameLength ; i++ )
+        if ( (u_char) fileName[i] < 32 || strchr( "\\/:*?\"<>|" , fileName[i] ) != NULL )
+            return FALSE;
+
+    // Windows toglie punti e spazi finali, quindi "a.txt." e "a.txt" sarebbero lo stesso file
+    if ( fileName[fileNameLength-1] == '.' || fileName[fileNameLength-1] == ' ' )
+        return FALSE;
+
+    // i nomi dei dispositivi ( CON, NUL, COM1... ) sono riservati anche con un'estensione
+    const char *reservedNames[] = { "CON" , "PRN" , "AUX" , "NUL" ,
+                                    "COM1" , "COM2" , "COM3" , "COM4" , "COM5" , "COM6" , "COM7" , "COM8" , "COM9" ,
+                                    "LPT1" , "LPT2" , "LPT3" , "LPT4" , "LPT5" , "LPT6" , "LPT7" , "LPT8" , "LPT9" };
+    int baseLength = strcspn( fileName , ". " );
+    for ( int i=0 ; i<(int) ( sizeof(reservedNames) / sizeof(reservedNames[0]) ) ; i++ )
+        if ( baseLength == (int) strlen( reservedNames[i] ) && _strnicmp( fileName , reservedNames[i] , baseLength ) == 0 )
+            return FALSE;
+
+    return TRUE;
+
+}
+
+void begin_fileReception ( pcap_t *nicHandle , const u_char *offerPacket ) {
+    //. funzione che prepara la ricezione di un file: i blocchi vengono poi scritti direttamente nel file di destinazione mappato in memoria
+
+    // se il file è già in ricezione la mia conferma è andata persa: la ripeto
+    EnterCriticalSection( &receptionLock );
+    boolean alreadyActive = fileReceptionState.active;
+    unsigned long long alreadyReceived = fileReceptionState.expectedOffset;
+    LeaveCriticalSection( &receptionLock );
+    if ( alreadyActive ) {
+        send_fileAcknowledgement( nicHandle , alreadyReceived );
+        return;
+    }
+
+    // controllo di conoscere la chiave con cui verrà criptato il file
+    EnterCriticalSection( &encryptionLock );
+    encryptionContext *offerEncryption = find_encryptionContext( offerPacket[15] );
+    encryptionContext fileEncryption;
+    if ( offerEncryption != NULL )
+        fileEncryption = *offerEncryption;
+    LeaveCriticalSection( &encryptionLock );
+    if ( offerEncryption == NULL )
+        return;
+
+    // leggo dimensione e nome del file
+    unsigned long long fileSize = read_packetOffset( offerPacket+16 );
+    int fileNameLength = offerPacket[24];
+    if ( fileNameLength > FILE_NAME_LEN )
+        return;
+    char fileName[FILE_NAME_LEN+1];
+    memcpy( fileName , offerPacket+25 , fileNameLength );
+    encrypt_buffer( fileName , fileNameLength , fileEncryption.key , fileEncryption.salt );
+    fileName[fileNameLength] = '\0';
+
+    //. controlli sull'offerta: il nome e la dimensione sono scelti dall'interlocutore
+    if ( check_receivedFileName( fileName ) == FALSE ) {
+        terminal_printf( "%s offered a file with an invalid name: refused." , myInterlocutor.name );
+        return;
+    }
+    if ( fileSize > FILE_MAX_SIZE ) {
+        terminal_printf( "%s offered %s (%llu bytes), larger than the %llu MB limit: refused." , myInterlocutor.name , fileName , fileSize , FILE_MAX_SIZE / ( 1024*1024 ) );
+        return;
+    }
+
+    // i file ricevuti vanno sempre nella cartella dei download
+    CreateDirectory( FILE_DOWNLOAD_DIR , NULL );
+    char filePath[FILE_PATH_LEN];
+    char partPath[FILE_PATH_LEN];
+    sprintf( filePath , "%s\\%s" , FILE_DOWNLOAD_DIR , fileName );
+    sprintf( partPath , "%s.part" , filePath );
+
+    // un file esistente viene riaperto solo se è l'interruzione di questo stesso trasferimento ( .part con la stessa dimensione )
+    unsigned long long expectedOffset;
+    boolean resuming = read_filePartInfo( partPath , fileSize , &expectedOffset );
+
+    // il disco deve poter contenere quello che manca del file
+    ULARGE_INTEGER freeBytes;
+    if ( GetDiskFreeSpaceEx( FILE_DOWNLOAD_DIR , &freeBytes , NULL , NULL ) && freeBytes.QuadPart < fileSize - expectedOffset + FILE_FREE_SPACE_MARGIN ) {
+        terminal_printf( "%s offered %s (%llu bytes), but there is not enough free disk space: refused." , myInterlocutor.name , fileName , fileSize );
+        return;
+    }
+
+
+
+    //. creo il file di destinazione con la dimensione finale e lo mappo in memoria
+    HANDLE fileHandle = CreateFile( filePath , GENERIC_READ | GENERIC_WRITE , 0 , NULL , resuming ? OPEN_EXISTING : CREATE_NEW , FILE_ATTRIBUTE_NORMAL , NULL );
+    if ( fileHandle == INVALID_HANDLE_VALUE ) {
+        if ( resuming == FALSE && GetLastError() == ERROR_FILE_EXISTS )
+            terminal_printf( "%s offered %s, but %s already exists: refused." , myInterlocutor.name , fileName , filePath );
+        else
+            terminal_printf( "Error: unable to create %s." , filePath );
+        return;
+    }
+
+    // da qui il file può essere ripreso ( ed è l'unico modo in cui verrà riaperto )
+    write_filePartInfo( partPath , fileSize , expectedOffset );
+
+    LARGE_INTEGER fileSizeStorage;
+    fileSizeStorage.QuadPart = fileSize;
+    SetFilePointerEx( fileHandle , fileSizeStorage , NULL , FILE_BEGIN );
+    SetEndOfFile( fileHandle );
+
+    HANDLE mappingHandle = NULL;
+    u_char *fileData = NULL;
+    if ( fileSize > 0 ) {
+        mappingHandle = CreateFileMapping( fileHandle , NULL , PAGE_READWRITE , 0 , 0 , NULL );
+        if ( mappingHandle != NULL )
+            fileData = (u_char*) MapViewOfFile( mappingHandle , FILE_MAP_WRITE , 0 , 0 , 0 );
+        if ( fileData == NULL ) {
+            terminal_printf( "Error: unable to map %s in memory." , filePath );
+            if ( mappingHandle != NULL )
+                CloseHandle( mappingHandle );
+            CloseHandle( fileHandle );
+            return;
+        }
+    }
+
+    terminal_printf( "%s is sending you %s (%llu bytes), saved in %s" , myInterlocutor.name , fileName , fileSize , FILE_DOWNLOAD_DIR );
+    if ( expectedOffset > 0 )
+        terminal_printf( "Resuming from byte %llu" , expectedOffset );
+
+    // rendo visibile la ricezione al thread di ricezione ed ai thread delle NIC aggiuntive
+    EnterCriticalSection( &receptionLock );
+    fileReceptionState.nicHandle = nicHandle;
+    fileReceptionState.fileHandle = fileHandle;
+    fileReceptionState.mappingHandle = mappingHandle;
+    strcpy( fileReceptionState.fileName , fileName );
+    strcpy( fileReceptionState.partPath , partPath );
+    fileReceptionState.fileData = fileData;
+    fileReceptionState.fileSize = fileSize;
+    fileReceptionState.expectedOffset = expectedOffset;
+    fileReceptionState.receivedMask = 0;
+    fileReceptionState.acknowledgedOffset = expectedOffset;
+    fileReceptionState.encryption = fileEncryption;
+    fileReceptionState.lastChunkClock = clock();
+    fileReceptionState.lastAcknowledgementClock = clock();
+    fileReceptionState.active = TRUE;
+    LeaveCriticalSection( &receptionLock );
+
+    // comunico all'interlocutore da dove partire
+    send_fileAcknowledgement( nicHandle , expectedOffset );
+
+}
+
+void end_fileReception () {
+    //. funzione che chiude il file in ricezione e stampa l'esito del trasferimento
+
+    // da qui in poi i blocchi in arrivo vengono scartati
+    EnterCriticalSection( &receptionLock );
+    if ( fileReceptionState.active == FALSE ) {
+        LeaveCriticalSection( &receptionLock );
+        return;
+    }
+    fileReceptionState.active = FALSE;
+    LeaveCriticalSection( &receptionLock );
+
+    fileReception *reception = &fileReceptionState;
+
+    //. chiudo il file
+    if ( reception->fileData != NULL ) {
+        FlushViewOfFile( reception->fileData , 0 );
+        UnmapViewOfFile( reception->fileData );
+    }
+    if ( reception->mappingHandle != NULL )
+        CloseHandle( reception->mappingHandle );
+    CloseHandle( reception->fileHandle );
+
+    //. stampo l'esito del trasferimento
+    if ( reception->expectedOffset >= reception->fileSize ) {
+        remove( reception->partPath );
+        terminal_printf( "%s : sent you the file %s" , myInterlocutor.name , reception->fileName );
+    } else {
+        write_filePartInfo( reception->partPath , reception->fileSize , reception->expectedOffset );
+        terminal_printf( "Transfer of %s interrupted at %llu of %llu bytes. It will resume when it is sent again." , reception->fileName , reception->expectedOffset , reception->fileSize );
+    }
+
+}
+
+void check_fileReceptionTimeout () {
+    //. funzione che interrompe la ricezione di un file se l'interlocutore ha smesso di inviare blocchi
+
+    EnterCriticalSection( &receptionLock );
+    boolean expired = fileReceptionState.active && ( clock() - fileReceptionState.lastChunkClock ) * 1000 / CLOCKS_PER_SEC >= FILE_RECEIVE_TIMEOUT;
+    LeaveCriticalSection( &receptionLock );
+
+    if ( expired )
+        end_fileReception();
+
+}
+
+
+
+
+
+
+//! === CHAT SECTION ===
+void send_message ( pcap_t *nicHandle , char *message ) {
+    //. funzione che invia un messaggio dopo averlo criptato
+
+    u_char packet[500];
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 4 ( per far riconoscere il messaggio )
+    packet[14] = 0x04;
+
+    // la chiave può cambiare mentre il thread di ricezione gestisce un cambio di chiave
+    EnterCriticalSection( &encryptionLock );
+
+    // se necessario preparo un cambio di chiave ( il messaggio viene comunque criptato con la chiave corrente ); la proposta viene
+    // accodata dopo aver lasciato la sezione critica, perché se la coda è piena l'attesa fermerebbe il thread di ricezione
+    u_char rekeyPacket[500];
+    boolean rekeyDue = prepare_rekeyProposal( rekeyPacket );
+
+    // setto il numero della chiave usata, così l'interlocutore sa con quale chiave decriptare
+    packet[15] = currentEncryption.epoch;
+
+    // setto la lunghezza del messaggio ( il messaggio criptato può contenere byte nulli, gli ultimi 8 byte sono per i timestamp )
+    int messageLength = strlen( message );
+    if ( messageLength > MESSAGE_TIMESTAMPS_OFFSET-18 )
+        messageLength = MESSAGE_TIMESTAMPS_OFFSET-18;
+    packet[16] = messageLength >> 8;
+    packet[17] = messageLength & 0xff;
+
+    // cripto il messaggio
+    encrypt_buffer( message , messageLength , currentEncryption.key , currentEncryption.salt );
+    bytesSinceRekey += messageLength;
+
+    LeaveCriticalSection( &encryptionLock );
+
+    if ( rekeyDue )
+        enqueue_packet( nicHandle , rekeyPacket , 500 , TRANSMIT_CONTROL );
+
+    // copio il messaggio nel pacchetto
+    for ( int i=0 ; i<messageLength ; i++ )
+        packet[18+i] = message[i];
+
+    // i messaggi portano timestamp ed eco, così durante una conversazione il RTT viene misurato senza ping
+    write_timestamps( packet+MESSAGE_TIMESTAMPS_OFFSET );
+
+    // accodo il pacchetto tra quelli interattivi, che non attendono dietro ai blocchi dei file
+    enqueue_packet( nicHandle , packet , 500 , TRANSMIT_INTERACTIVE );
+
+}
+
+void send_userInput ( pcap_t *nicHandle , char *message ) {
+    //. funzione che esegue quanto scritto dall'utente: un comando se inizia con /, altrimenti un messaggio
+
+    // /stats stampa le statistiche delle code di invio
+    if ( strncmp( message , "/stats" , 6 ) == 0 ) {
+        print_keepaliveStats();
+        print_transmitStats();
+        print_stripeStats();
+        print_admissionStats( stdout );
+        print_terminalStats( stdout );
+        return;
+    }
+
+    if ( strncmp( message , "/send " , 6 ) != 0 ) {
+        send_message( nicHandle , message );
+        return;
+    }
+
+    // tolgo il carattere di newline dal percorso del file
+    char *filePath = message+6;
+    filePath[strcspn( filePath , "\n" )] = '\0';
+
+    // il file viene inviato in sottofondo, così nel frattempo si può continuare a scrivere
+    start_fileSending( nicHandle , filePath );
+
+}
+
+void store_daemonMessage ( const char *message , int messageLength ) {
+    //. funzione che mette un messaggio ricevuto nella coda dei client ( se è piena si perde il più vecchio )
+
+    EnterCriticalSection( &daemonLock );
+
+    if ( daemonSession.inboxCount == DAEMON_INBOX_LEN ) {
+        daemonSession.inboxHead = ( daemonSession.inboxHead + 1 ) % DAEMON_INBOX_LEN;
+        daemonSession.inboxCount--;
+        daemonSession.droppedMessages++;
+    }
+
+    daemonMessage *slot = &daemonSession.inbox[( daemonSession.inboxHead + daemonSession.inboxCount ) % DAEMON_INBOX_LEN];
+    slot->length = messageLength;
+    memcpy( slot->text , message , messageLength );
+    daemonSession.inboxCount++;
+
+    LeaveCriticalSection( &daemonLock );
+
+}
+
+void check_simMessage ( const char *message ) {
+    //. funzione che conta un messaggio ricevuto da un dispositivo simulato: è decriptato bene se è quello inviato dal simulatore
+
+    if ( strncmp( message , "sim " , 4 ) == 0 )
+        simulator.messagesDelivered++;
+    else
+        simulator.decryptionFailures++;
+
+}
+
+void print_message ( const u_char *packetData ) {
+    //. funzione che decripta e stampa un messaggio
+
+    // controllo che la lunghezza del messaggio sia valida
+    int messageLength = packetData[16] << 8 | packetData[17];
+    if ( messageLength > MESSAGE_TIMESTAMPS_OFFSET-18 )
+        return;
+
+    // controllo di conoscere la chiave con cui è stato criptato il messaggio
+    EnterCriticalSection( &encryptionLock );
+    encryptionContext *messageEncryption = find_encryptionContext( packetData[15] );
+    if ( messageEncryption == NULL ) {
+        LeaveCriticalSection( &encryptionLock );
+        return;
+    }
+
+    // decripto il messaggio
+    char *decryptedMessage = allocate_messageBuffer( messageLength + 1 );
+    memcpy( decryptedMessage , packetData+18 , messageLength );
+    encrypt_buffer( decryptedMessage , messageLength , messageEncryption->key , messageEncryption->salt );
+    decryptedMessage[messageLength] = '\0';
+
+    // anche i byte criptati dall'interlocutore consumano la chiave corrente
+    if ( messageEncryption == &currentEncryption )
+        bytesSinceRekey += messageLength;
+    LeaveCriticalSection( &encryptionLock );
+
+    // il simulatore controlla il messaggio invece di stamparlo
+    if ( simulationMode ) {
+        check_simMessage( decryptedMessage );
+        return;
+    }
+
+    // il daemon consegna il messaggio ai client invece di stamparlo
+    if ( daemonMode ) {
+        store_daemonMessage( decryptedMessage , messageLength );
+        return;
+    }
+
+    // il messaggio va nel riquadro dei messaggi, che viene ridisegnato a frequenza limitata
+    decryptedMessage[strcspn( decryptedMessage , "\n" )] = '\0';
+    terminal_printf( "%s : %s" , myInterlocutor.name , decryptedMessage );
+
+}
+
+void handle_sessionPacket ( pcap_t *nicHandle , const packetHeader *header , const u_char *packetData ) {
+    //. funzione che smista un pacchetto della sessione in base al suo tipo
+
+    //. controlli sulla validità del pacchetto
+    // controllo che il pacchetto sia dell'applicazione
+    if ( packetData[12] != 0x7a || packetData[13] != 0xbc )
+        return;
+
+    // controllo che il pacchetto sia per me
+    if ( memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+        return;
+
+    // controllo che il pacchetto sia stato inviato dal dispositivo scelto
+    if ( memcmp( packetData+6 , dsapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+        return;
+
+
+
+    //. operazioni da eseguire in base al tipo di pacchetto
+    // qualsiasi pacchetto dell'interlocutore dimostra che è ancora raggiungibile
+    note_peerActivity();
+
+    switch ( packetData[14] ) {
+
+        case 0x04: // messaggio ( l'interlocutore non è limitato: i pacchetti degli altri dispositivi sono già stati scartati )
+            read_timestamps( packetData+MESSAGE_TIMESTAMPS_OFFSET );
+            print_message( packetData );
+            break;
+
+        case 0x12: // ping: rispondo subito
+            read_timestamps( packetData+15 );
+            send_keepalivePacket( nicHandle , 0x13 );
+            break;
+
+        case 0x13: // pong
+            read_timestamps( packetData+15 );
+            break;
+
+        case 0x05: // chiusura della connessione
+            end_session( "The connection has been closed by the other device." );
+            break;
+
+        case 0x06: // proposta di una nuova chiave
+            EnterCriticalSection( &encryptionLock );
+            receive_rekeyPacket( nicHandle , packetData );
+            LeaveCriticalSection( &encryptionLock );
+            break;
+
+        case 0x07: // conferma della nuova chiave
+            EnterCriticalSection( &encryptionLock );
+            receive_rekeyAcknowledgement( packetData );
+            LeaveCriticalSection( &encryptionLock );
+            break;
+
+        case 0x08: // proposta di un file
+            begin_fileReception( nicHandle , packetData );
+            break;
+
+        case 0x09: // conferma di ricezione di un file
+            post_fileAcknowledgement( packetData );
+            break;
+
+        case 0x0a: // blocco di un file
+            store_fileChunk( packetData , header->caplen );
+            break;
+
+        case 0x11: // fine di un file
+            end_fileReception();
+            break;
+
+    }
+
+}
+
+DWORD WINAPI receive_sessionPackets ( void *data ) {
+    //. funzione eseguita dal thread che riceve tutti i pacchetti della sessione mentre l'utente scrive
+
+    pcap_t *nicHandle = (pcap_t*) data;
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+
+    while ( (readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0 ) {
+
+        check_fileReceptionTimeout();
+
+        if ( readingResult == 0 )
+            continue;
+
+        handle_sessionPacket( nicHandle , header , packetData );
+
+    }
+
+    return 0;
+
+}
+
+
+
+DWORD WINAPI receive_stripeLinkPackets ( void *data ) {
+    //. funzione eseguita dai thread che ricevono i blocchi dei file sulle NIC aggiuntive ( e la sessione, se passa su una di loro )
+
+    stripeLink *link = (stripeLink*) data;
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+
+    while ( (readingResult=pcap_next_ex( link->nicHandle , &header , &packetData )) >= 0 ) {
+        if ( readingResult == 0 )
+            continue;
+
+        // rispondo agli annunci arrivati dopo la fine dell'abbinamento, così l'interlocutore smette di attendere
+        if ( receive_stripeHello( link , packetData ) == 0 ) {
+            send_stripeHello( link , TRUE );
+            continue;
+        }
+
+        //. controlli sulla validità del pacchetto
+        // controllo che il pacchetto sia dell'applicazione
+        if ( packetData[12] != 0x7a || packetData[13] != 0xbc )
+            continue;
+
+        // controllo che il pacchetto sia per la mia NIC su questo link
+        if ( memcmp( packetData , link->localAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+            continue;
+
+        // controllo che il pacchetto sia stato inviato dalla NIC dell'interlocutore su questo link
+        if ( memcmp( packetData+6 , link->peerAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+            continue;
+
+        //. operazioni da eseguire se il pacchetto è valido
+        if ( packetData[14] == 0x0a ) {
+            store_fileChunk( packetData , header->caplen );
+            continue;
+        }
+
+        // gli altri pacchetti della sessione arrivano su questo link solo se l'interlocutore ci ha spostato la sessione: lo seguo
+        if ( move_sessionLink( link - stripeLinks ) )
+            handle_sessionPacket( link->nicHandle , header , packetData );
+
+    }
+
+    return 0;
+
+}
+
+void start_stripeLinkReceivers () {
+    //. funzione che avvia un thread di ricezione per ogni NIC aggiuntiva abbinata
+
+    for ( int i=1 ; i<stripeLinksCount ; i++ ) {
+
+        if ( stripeLinks[i].up == FALSE )
+            continue;
+
+        DWORD threadID;
+        HANDLE threadHandle = CreateThread( NULL , 0 , receive_stripeLinkPackets , (void*) &stripeLinks[i] , 0 , &threadID );
+        if ( threadHandle == NULL ) {
+            fprintf( stderr , "Error creating the threads used to receive files. Restart the program.\n" );
+            Sleep(10000); // 10 secondi
+            exit(1);
+        }
+
+    }
+
+}
+
+
+
+
+
+
+//! === GROUP CONVERSATION SECTION ===
+void set_groupAddress ( unsigned short chosenGroupId ) {
+    //. funzione che imposta l'indirizzo multicast del gruppo
+
+    // 03:44:49:53 = multicast amministrato localmente + "DIS", gli ultimi due byte sono il numero del gruppo
+    groupId = chosenGroupId;
+    groupAddress.addressBytes[0] = 0x03;
+    groupAddress.addressBytes[1] = 0x44;
+    groupAddress.addressBytes[2] = 0x49;
+    groupAddress.addressBytes[3] = 0x53;
+    groupAddress.addressBytes[4] = chosenGroupId >> 8;
+    groupAddress.addressBytes[5] = chosenGroupId & 0xff;
+
+}
+
+void choose_groupName () {
+    //. funzione che fa scegliere all'utente il nome con cui gli altri membri lo visualizzano
+
+    printf("Choose a name (long between 10 and 50 characters): ");
+    fgets( groupName , 51 , stdin );
+
+    // controllo che il nome sia lungo almeno 10 caratteri e che non sia più lungo di 50 caratteri. Se non lo è, uso un nome di default
+    if ( strlen(groupName) < 10 || strlen(groupName) > 50 )
+        strcpy( groupName , "NoNameDevice\n" );
+
+    // setto il terminatore al posto del carattere di newline
+    groupName[strcspn( groupName , "\n" )] = '\0';
+
+}
+
+groupMember *find_groupMember ( const u_char *addressBytes ) {
+    //. funzione che cerca un membro del gruppo in base al MAC ( NULL se non è un membro )
+
+    for ( int i=0 ; i<groupMembersCount ; i++ )
+        if ( memcmp( groupMembers[i].interlocutor.address.addressBytes , addressBytes , ETHER_ADDR_LEN ) == 0 )
+            return &groupMembers[i];
+
+    return NULL;
+
+}
+
+encryptionContext *find_groupEncryptionContext ( u_char epoch ) {
+    //. funzione che restituisce la chiave di gruppo con il numero specificato ( NULL se non la conosco )
+
+    if ( groupEncryption.epoch == epoch )
+        return &groupEncryption;
+
+    // la chiave precedente serve solo per i messaggi in viaggio durante il cambio: dopo chi è uscito non può più usarla
+    if ( previousGroupEncryption.epoch == epoch && GetTickCount() - previousGroupKeyTick < GROUP_PREVIOUS_KEY_WINDOW )
+        return &previousGroupEncryption;
+
+    return NULL;
+
+}
+
+boolean is_groupMemberMessage ( const u_char *packetData ) {
+    //. funzione che indica se un messaggio di gruppo arriva da un membro con una chiave valida ( questi messaggi non passano dal controllo di ammissione )
+
+    EnterCriticalSection( &groupLock );
+    boolean memberMessage = ( find_groupEncryptionContext( packetData[17] ) != NULL );
+
+    // il proprietario conosce i membri: il messaggio di un altro dispositivo passa dal controllo anche se usa la chiave giusta
+    if ( groupOwner && find_groupMember( packetData+ETHER_ADDR_LEN ) == NULL )
+        memberMessage = FALSE;
+    LeaveCriticalSection( &groupLock );
+
+    return memberMessage;
+
+}
+
+
+
+void build_groupPacketHeader ( u_char *packet , mac_address *destinationAddress , u_char packetType ) {
+    //. funzione che scrive l'header comune a tutti i pacchetti del gruppo
+
+    // setto il DSAP all'indirizzo del gruppo o al MAC del membro specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = destinationAddress->addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il tipo di pacchetto ed il numero del gruppo
+    packet[14] = packetType;
+    packet[15] = groupId >> 8;
+    packet[16] = groupId & 0xff;
+
+}
+
+void derive_groupSecrets ( keyNumber sharedSecret , encryptionContext *memberEncryption , u_char *joinTag , u_char *leaveTag , u_char *ownerLeaveTag ) {
+    //. funzione che ricava dal segreto comune tra proprietario e membro la chiave personale e le prove di entrata ed uscita
+
+    u_char keyBytes[KEY_NUMBER_LEN];
+
+    derive_encryptionContext( sharedSecret , memberEncryption );
+
+    derive_keyBytes( sharedSecret , GROUP_LABEL_JOIN , keyBytes );
+    memcpy( joinTag , keyBytes , GROUP_TAG_LEN );
+    derive_keyBytes( sharedSecret , GROUP_LABEL_LEAVE , keyBytes );
+    memcpy( leaveTag , keyBytes , GROUP_TAG_LEN );
+    derive_keyBytes( sharedSecret , GROUP_LABEL_OWNER_LEAVE , keyBytes );
+    memcpy( ownerLeaveTag , keyBytes , GROUP_TAG_LEN );
+
+}
+
+
+
+void send_groupJoin ( pcap_t *nicHandle ) {
+    //. funzione che chiede al proprietario del gruppo di entrare nel gruppo
+
+    u_char packet[500];
+
+    // setto il tipo a 11 ( per far riconoscere la richiesta di entrare nel gruppo ), il mio nome ed il mio valore pubblico
+    build_groupPacketHeader( packet , &groupAddress , 0x0b );
+    strcpy( (char*) packet+17 , groupName );
+    memcpy( packet+GROUP_PUBLIC_OFFSET , myGroupPublicValue , KEY_NUMBER_LEN );
+
+    enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void send_groupLeave ( pcap_t *nicHandle ) {
+    //. funzione che comunica l'uscita dal gruppo, con la prova che ad uscire sono proprio io
+
+    u_char packet[500];
+
+    // un membro avvisa solo il proprietario, che cambierà la chiave di gruppo
+    if ( groupOwner == FALSE ) {
+        build_groupPacketHeader( packet , &groupOwnerAddress , 0x0f );
+        memcpy( packet+17 , myLeaveTag , GROUP_TAG_LEN );
+        enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+    }
+
+    // il proprietario avvisa ogni membro con la prova ricavata dal segreto che ha in comune con lui
+    else {
+        EnterCriticalSection( &groupLock );
+        for ( int i=0 ; i<groupMembersCount ; i++ ) {
+            build_groupPacketHeader( packet , &groupMembers[i].interlocutor.address , 0x0f );
+            memcpy( packet+17 , groupMembers[i].ownerLeaveTag , GROUP_TAG_LEN );
+            enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+        }
+        LeaveCriticalSection( &groupLock );
+    }
+
+    // attendo che l'uscita sia partita, perché il programma sta per chiudersi
+    wait_transmitQueue( TRANSMIT_CONTROL , 1000 ); // 1 secondo
+
+}
+
+void send_groupMemberKey ( pcap_t *nicHandle , groupMember *member ) {
+    //. funzione che risponde al nuovo membro con il mio valore pubblico, da cui ricaverà la chiave personale
+
+    u_char packet[500];
+
+    // setto il tipo a 12 ( per far riconoscere la risposta alla richiesta di entrare )
+    build_groupPacketHeader( packet , &member->interlocutor.address , 0x0c );
+
+    // la chiave personale non viaggia: il membro la ricava dal segreto comune, e la prova gli conferma che l'ho ricavata dal suo valore pubblico
+    memcpy( packet+17 , member->ownerPublicValue , KEY_NUMBER_LEN );
+    memcpy( packet+17+KEY_NUMBER_LEN , member->joinTag , GROUP_TAG_LEN );
+
+    // la risposta viene inviata dal thread di ricezione: non attendo la coda ( chi entra ripete la richiesta )
+    try_enqueuePacket( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void send_groupKey ( pcap_t *nicHandle , groupMember *member ) {
+    //. funzione che invia al membro la chiave di gruppo corrente, criptata con la sua chiave personale ( groupLock deve essere preso )
+
+    u_char packet[500];
+
+    // setto il tipo a 13 ( per far riconoscere la chiave di gruppo ) ed il numero della chiave
+    build_groupPacketHeader( packet , &member->interlocutor.address , 0x0d );
+    packet[17] = groupEncryption.epoch;
+
+    // copio la chiave di gruppo ed il sale nel pacchetto e li cripto con la chiave personale del membro;
+    // la prova è calcolata su numero, chiave e sale in chiaro, così il membro scarta le chiavi che non vengono da me
+    memcpy( packet+18 , groupEncryption.key , ENCRYPTION_KEY_LEN );
+    memcpy( packet+18+ENCRYPTION_KEY_LEN , groupEncryption.salt , ENCRYPTION_SALT_LEN );
+    compute_keyTag( member->sharedSecret , packet+17 , 1+ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN , packet+GROUP_KEY_TAG_OFFSET , GROUP_TAG_LEN );
+    encrypt_buffer( (char*) packet+18 , ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN , member->memberEncryption.key , member->memberEncryption.salt );
+
+    // la chiave viene inviata dal thread di ricezione con groupLock preso: non attendo la coda
+    try_enqueuePacket( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+
+}
+
+void rekey_group ( pcap_t *nicHandle ) {
+    //. funzione che genera una nuova chiave di gruppo e la invia ai membri ( dopo ogni entrata o uscita, groupLock deve essere preso )
+
+    // chi è uscito conosce la vecchia chiave ma non riceve la nuova
+    previousGroupEncryption = groupEncryption;
+    generate_encryptionKey( groupEncryption.key , ENCRYPTION_KEY_LEN );
+    generate_encryptionSalt( groupEncryption.salt );
+    groupEncryption.epoch = previousGroupEncryption.epoch + 1;
+    previousGroupKeyTick = GetTickCount();
+
+    for ( int i=0 ; i<groupMembersCount ; i++ )
+        send_groupKey( nicHandle , &groupMembers[i] );
+
+}
+
+void send_groupMessage ( pcap_t *nicHandle , char *message ) {
+    //. funzione che invia un messaggio a tutto il gruppo con una sola criptazione ed un solo pacchetto
+
+    u_char packet[500];
+
+    // copio la chiave di gruppo, che il thread di ricezione può cambiare in qualsiasi momento
+    EnterCriticalSection( &groupLock );
+    encryptionContext messageEncryption = groupEncryption;
+    LeaveCriticalSection( &groupLock );
+
+    // setto il tipo a 14 ( per far riconoscere il messaggio di gruppo ) ed il numero della chiave
+    build_groupPacketHeader( packet , &groupAddress , 0x0e );
+    packet[17] = messageEncryption.epoch;
+
+    // il nome del mittente viaggia criptato insieme al messaggio
+    message[strcspn( message , "\n" )] = '\0';
+    int messageLength = snprintf( (char*) packet+20 , 500-20 , "%s : %s" , groupName , message );
+    if ( messageLength > 500-21 )
+        messageLength = 500-21;
+    packet[18] = messageLength >> 8;
+    packet[19] = messageLength & 0xff;
+
+    // cripto il messaggio una volta sola, qualunque sia il numero di membri
+    encrypt_buffer( (char*) packet+20 , messageLength , messageEncryption.key , messageEncryption.salt );
+
+    enqueue_packet( nicHandle , packet , 20+messageLength , TRANSMIT_INTERACTIVE );
+
+}
+
+double process_cpuSeconds () {
+    //. funzione che restituisce i secondi di CPU usati finora da tutti i thread del processo ( utente e kernel )
+
+    FILETIME creationTime , exitTime , kernelTime , userTime;
+    GetProcessTimes( GetCurrentProcess() , &creationTime , &exitTime , &kernelTime , &userTime );
+
+    // i tempi sono in unità di 100 nanosecondi
+    unsigned long long kernel = ( (unsigned long long) kernelTime.dwHighDateTime << 32 ) | kernelTime.dwLowDateTime;
+    unsigned long long user = ( (unsigned long long) userTime.dwHighDateTime << 32 ) | userTime.dwLowDateTime;
+    return ( kernel + user ) / 10000000.0;
+
+}
+
+void benchmark_group ( char *nicName , int messagesCount ) {
+    //. funzione che confronta il messaggio di gruppo ( una criptazione ed un pacchetto multicast ) con un messaggio criptato ed inviato ad ogni membro, con 2, 16 e 128 membri
+
+    pcap_t *nicHandle = open_NIC( nicName );
+    set_groupAddress( 0 );
+    strcpy( groupName , "BenchmarkDevice" );
+    groupOwner = TRUE;
+    generate_encryptionKey( groupEncryption.key , ENCRYPTION_KEY_LEN );
+    generate_encryptionSalt( groupEncryption.salt );
+
+    int membersCounts[3] = { 2 , 16 , GROUP_MAX_MEMBERS };
+    for ( int c=0 ; c<3 ; c++ ) {
+
+        // membri finti con indirizzi amministrati localmente e chiavi personali casuali: nessuno risponde, conta solo il costo dell'invio
+        groupMembersCount = membersCounts[c];
+        for ( int i=0 ; i<groupMembersCount ; i++ ) {
+            u_char memberBytes[ETHER_ADDR_LEN] = { 0x02 , 0x44 , 0x49 , 0x53 , 0x00 , (u_char) i };
+            memcpy( groupMembers[i].interlocutor.address.addressBytes , memberBytes , ETHER_ADDR_LEN );
+            generate_encryptionKey( groupMembers[i].memberEncryption.key , ENCRYPTION_KEY_LEN );
+            generate_encryptionSalt( groupMembers[i].memberEncryption.salt );
+        }
+
+        for ( int unicast=0 ; unicast<2 ; unicast++ ) {
+
+            wait_transmitQueue( TRANSMIT_INTERACTIVE , 60000 ); // 1 minuto
+            unsigned long long packetsBefore = transmitQueues[TRANSMIT_INTERACTIVE].sentPackets;
+            unsigned long long bytesBefore = transmitQueues[TRANSMIT_INTERACTIVE].transmitBytes;
+            double cpuBefore = process_cpuSeconds();
+            LARGE_INTEGER benchmarkStart;
+            QueryPerformanceCounter( &benchmarkStart );
+
+            for ( int m=0 ; m<messagesCount ; m++ ) {
+
+                char message[100];
+                sprintf( message , "benchmark message %d" , m );
+                if ( unicast == 0 ) {
+                    send_groupMessage( nicHandle , message );
+                    continue;
+                }
+
+                // stesso messaggio, criptato con la chiave personale di ogni membro ed inviato al suo MAC
+                for ( int i=0 ; i<groupMembersCount ; i++ ) {
+                    u_char packet[500];
+                    build_groupPacketHeader( packet , &groupMembers[i].interlocutor.address , 0x0e );
+                    packet[17] = groupMembers[i].memberEncryption.epoch;
+                    int messageLength = snprintf( (char*) packet+20 , 500-20 , "%s : %s" , groupName , message );
+                    packet[18] = messageLength >> 8;
+                    packet[19] = messageLength & 0xff;
+                    encrypt_buffer( (char*) packet+20 , messageLength , groupMembers[i].memberEncryption.key , groupMembers[i].memberEncryption.salt );
+                    enqueue_packet( nicHandle , packet , 20+messageLength , TRANSMIT_INTERACTIVE );
+                }
+
+            }
+
+            wait_transmitQueue( TRANSMIT_INTERACTIVE , 60000 ); // 1 minuto
+            double seconds = elapsed_seconds( benchmarkStart );
+            double cpuSeconds = process_cpuSeconds() - cpuBefore;
+
+            // il driver conta anche l'intestazione di ogni pacchetto nella coda di invio
+            unsigned long long packets = transmitQueues[TRANSMIT_INTERACTIVE].sentPackets - packetsBefore;
+            unsigned long long bytes = transmitQueues[TRANSMIT_INTERACTIVE].transmitBytes - bytesBefore - packets * sizeof(packetHeader);
+            printf( "%3d members, %-9s: %llu frames, %.0f bytes and %.1f us of CPU per message, %.3f s, %.0f messages/s\n" , groupMembersCount , unicast ? "unicast" : "multicast" ,
+                    packets , (double) bytes / messagesCount , cpuSeconds * 1000000 / messagesCount , seconds , seconds > 0 ? messagesCount / seconds : 0 );
+
+        }
+
+    }
+
+    groupMembersCount = 0;
+    pcap_close( nicHandle );
+
+}
+
+
+
+void handle_groupJoin ( pcap_t *nicHandle , const u_char *packetData ) {
+    //. funzione con cui il proprietario accoglie un nuovo membro
+
+    // un valore pubblico fuori dal sottogruppo renderebbe prevedibile il segreto comune
+    keyNumber memberPublicNumber = read_keyNumber( packetData+GROUP_PUBLIC_OFFSET );
+    if ( check_publicKeyNumber( memberPublicNumber ) == FALSE )
+        return;
+
+    EnterCriticalSection( &groupLock );
+
+    // se è già un membro e la richiesta ha lo stesso valore pubblico ha perso la risposta: gli reinvio il mio valore pubblico e la chiave di gruppo.
+    // con un valore diverso la richiesta non è sua ( chi la invia non conosce il suo esponente ) e viene ignorata
+    groupMember *member = find_groupMember( packetData+ETHER_ADDR_LEN );
+    if ( member != NULL ) {
+        if ( memcmp( member->memberPublicValue , packetData+GROUP_PUBLIC_OFFSET , KEY_NUMBER_LEN ) == 0 ) {
+            send_groupMemberKey( nicHandle , member );
+            send_groupKey( nicHandle , member );
+        }
+        LeaveCriticalSection( &groupLock );
+        return;
+    }
+
+    if ( groupMembersCount == GROUP_MAX_MEMBERS ) {
+        LeaveCriticalSection( &groupLock );
+        return;
+    }
+
+    LeaveCriticalSection( &groupLock );
+
+    // scambio di chiavi ( qualche millisecondo, fuori dal lock perché solo questo thread cambia i membri ):
+    // il mio esponente serve solo per questo membro, poi lo dimentico
+    groupMember newMember;
+    memcpy( newMember.interlocutor.address.addressBytes , packetData+ETHER_ADDR_LEN , ETHER_ADDR_LEN );
+    strncpy( newMember.interlocutor.name , (const char*) packetData+17 , 49 );
+    newMember.interlocutor.name[49] = '\0';
+    memcpy( newMember.memberPublicValue , packetData+GROUP_PUBLIC_OFFSET , KEY_NUMBER_LEN );
+
+    keyNumber ownerExponent = generate_keyExponent();
+    write_keyNumber( newMember.ownerPublicValue , compute_publicKeyNumber( ownerExponent ) );
+    keyNumber sharedSecret = power_keyNumber( memberPublicNumber , ownerExponent );
+    derive_groupSecrets( sharedSecret , &newMember.memberEncryption , newMember.joinTag , newMember.leaveTag , newMember.ownerLeaveTag );
+    newMember.sharedSecret = sharedSecret;
+
+    // aggiungo il membro
+    EnterCriticalSection( &groupLock );
+    member = &groupMembers[groupMembersCount++];
+    *member = newMember;
+
+    terminal_printf( "%s joined the group (%d members)" , member->interlocutor.name , groupMembersCount );
+
+    // il nuovo membro non deve poter leggere i messaggi precedenti
+    send_groupMemberKey( nicHandle , member );
+    rekey_group( nicHandle );
+
+    LeaveCriticalSection( &groupLock );
+
+}
+
+void handle_groupLeave ( pcap_t *nicHandle , const u_char *packetData ) {
+    //. funzione che gestisce l'uscita di un membro dal gruppo ( solo se accompagnata dalla prova del mittente )
+
+    // se esce il proprietario il gruppo non può più cambiare chiave
+    if ( groupOwner == FALSE ) {
+        if ( memcmp( packetData+ETHER_ADDR_LEN , groupOwnerAddress.addressBytes , ETHER_ADDR_LEN ) == 0 && memcmp( packetData+17 , myOwnerLeaveTag , GROUP_TAG_LEN ) == 0 )
+            terminal_printf("---\nThe group owner has left the group.\n---");
+        return;
+    }
+
+    EnterCriticalSection( &groupLock );
+
+    // chi non conosce il segreto comune con il membro non può farlo uscire
+    groupMember *member = find_groupMember( packetData+ETHER_ADDR_LEN );
+    if ( member == NULL || memcmp( packetData+17 , member->leaveTag , GROUP_TAG_LEN ) != 0 ) {
+        LeaveCriticalSection( &groupLock );
+        return;
+    }
+
+    terminal_printf( "%s left the group" , member->interlocutor.name );
+
+    // sposto l'ultimo membro al posto di quello uscito e cambio la chiave di gruppo
+    *member = groupMembers[--groupMembersCount];
+    rekey_group( nicHandle );
+
+    LeaveCriticalSection( &groupLock );
+
+}
+
+boolean accept_groupMemberKey ( const u_char *packetData ) {
+    //. funzione con cui un membro ricava la chiave personale dal valore pubblico del proprietario ( FALSE se la prova non corrisponde )
+
+    keyNumber ownerPublicNumber = read_keyNumber( packetData+17 );
+    if ( check_publicKeyNumber( ownerPublicNumber ) == FALSE )
+        return FALSE;
+
+    encryptionContext memberEncryption;
+    u_char joinTag[GROUP_TAG_LEN] , leaveTag[GROUP_TAG_LEN] , ownerLeaveTag[GROUP_TAG_LEN];
+    keyNumber sharedSecret = power_keyNumber( ownerPublicNumber , myGroupExponent );
+    derive_groupSecrets( sharedSecret , &memberEncryption , joinTag , leaveTag , ownerLeaveTag );
+
+    // la prova conferma che il proprietario ha ricavato il segreto dal mio valore pubblico
+    if ( memcmp( joinTag , packetData+17+KEY_NUMBER_LEN , GROUP_TAG_LEN ) != 0 )
+        return FALSE;
+
+    // da questo momento riconosco il proprietario
+    memcpy( groupOwnerAddress.addressBytes , packetData+ETHER_ADDR_LEN , ETHER_ADDR_LEN );
+    myMemberEncryption = memberEncryption;
+    myGroupSharedSecret = sharedSecret;
+    memcpy( myLeaveTag , leaveTag , GROUP_TAG_LEN );
+    memcpy( myOwnerLeaveTag , ownerLeaveTag , GROUP_TAG_LEN );
+
+    return TRUE;
+
+}
+
+boolean handle_groupKey ( const u_char *packetData ) {
+    //. funzione con cui un membro mette in uso la chiave di gruppo ricevuta dal proprietario
+
+    // controllo che la chiave arrivi dal proprietario del gruppo
+    if ( memcmp( packetData+ETHER_ADDR_LEN , groupOwnerAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+        return FALSE;
+
+    // decripto la chiave di gruppo con la mia chiave personale ( il numero della chiave resta davanti, perché fa parte della prova )
+    u_char keyMaterial[1+ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN];
+    memcpy( keyMaterial , packetData+17 , 1+ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN );
+    encrypt_buffer( (char*) keyMaterial+1 , ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN , myMemberEncryption.key , myMemberEncryption.salt );
+
+    // il MAC del mittente si può falsificare, la prova no: solo il proprietario conosce il segreto comune con me
+    u_char tag[GROUP_TAG_LEN];
+    compute_keyTag( myGroupSharedSecret , keyMaterial , 1+ENCRYPTION_KEY_LEN+ENCRYPTION_SALT_LEN , tag , GROUP_TAG_LEN );
+    if ( memcmp( tag , packetData+GROUP_KEY_TAG_OFFSET , GROUP_TAG_LEN ) != 0 )
+        return FALSE;
+
+    EnterCriticalSection( &groupLock );
+
+    // una chiave più vecchia di quella in uso ( ripetuta da qualcun altro ) non viene rimessa in uso
+    if ( groupKeyReceived && (u_char) ( packetData[17] - groupEncryption.epoch ) >= 128 ) {
+        LeaveCriticalSection( &groupLock );
+        return FALSE;
+    }
+
+    // una chiave già in uso ( reinviata dal proprietario ) non sposta quella precedente
+    if ( packetData[17] != groupEncryption.epoch || groupKeyReceived == FALSE ) {
+        previousGroupEncryption = groupEncryption;
+        previousGroupKeyTick = GetTickCount();
+    }
+
+    memcpy( groupEncryption.key , keyMaterial+1 , ENCRYPTION_KEY_LEN );
+    groupEncryption.key[ENCRYPTION_KEY_LEN] = '\0';
+    memcpy( groupEncryption.salt , keyMaterial+1+ENCRYPTION_KEY_LEN , ENCRYPTION_SALT_LEN );
+    groupEncryption.salt[ENCRYPTION_SALT_LEN] = '\0';
+    groupEncryption.epoch = packetData[17];
+    groupKeyReceived = TRUE;
+
+    LeaveCriticalSection( &groupLock );
+
+    return TRUE;
+
+}
+
+void handle_groupMessage ( const u_char *packetData , int capturedLength ) {
+    //. funzione che decripta e stampa un messaggio di gruppo
+
+    // controllo che la lunghezza del messaggio sia valida e che il messaggio sia tutto nel pacchetto catturato
+    int messageLength = packetData[18] << 8 | packetData[19];
+    if ( messageLength > 500-21 || 20+messageLength > capturedLength )
+        return;
+
+    // controllo di conoscere la chiave con cui è stato criptato il messaggio e la copio, perché il proprietario può cambiarla intanto
+    EnterCriticalSection( &groupLock );
+    encryptionContext *messageEncryption = find_groupEncryptionContext( packetData[17] );
+    if ( messageEncryption == NULL ) {
+        LeaveCriticalSection( &groupLock );
+        return;
+    }
+    encryptionContext messageKey = *messageEncryption;
+    LeaveCriticalSection( &groupLock );
+
+    // decripto il messaggio
+    char decryptedMessage[500];
+    memcpy( decryptedMessage , packetData+20 , messageLength );
+    encrypt_buffer( decryptedMessage , messageLength , messageKey.key , messageKey.salt );
+    decryptedMessage[messageLength] = '\0';
+
+    // stampo il messaggio ( contiene già il nome del mittente )
+    decryptedMessage[strcspn( decryptedMessage , "\n" )] = '\0';
+    terminal_printf( "%s" , decryptedMessage );
+
+}
+
+int classify_groupPacket ( const u_char *packetData , int capturedLength ) {
+    //. funzione che restituisce il tipo di un pacchetto del mio gruppo ( -1 se il pacchetto non mi riguarda )
+
+    // il messaggio più corto ha almeno l'header del gruppo, il numero della chiave e la lunghezza
+    if ( capturedLength < 20 )
+        return -1;
+
+    // controllo che il pacchetto sia dell'applicazione e del mio gruppo
+    if ( packetData[12] != 0x7a || packetData[13] != 0xbc )
+        return -1;
+    if ( packetData[15] != ( groupId >> 8 ) || packetData[16] != ( groupId & 0xff ) )
+        return -1;
+
+    // tutti i pacchetti del gruppo tranne i messaggi vengono inviati lunghi 500 byte
+    if ( packetData[14] != 0x0e && capturedLength < 500 )
+        return -1;
+
+    // scarto i pacchetti inviati da me
+    if ( memcmp( packetData+ETHER_ADDR_LEN , ssapAddress.addressBytes , ETHER_ADDR_LEN ) == 0 )
+        return -1;
+
+    // controllo che il pacchetto sia per il gruppo o per me
+    if ( memcmp( packetData , groupAddress.addressBytes , ETHER_ADDR_LEN ) != 0 && memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+        return -1;
+
+    return packetData[14];
+
+}
+
+DWORD WINAPI receive_groupPackets ( void *data ) {
+    //. funzione eseguita dal thread che riceve i pacchetti del gruppo mentre l'utente scrive
+
+    pcap_t *nicHandle = (pcap_t*) data;
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+
+    while ( (readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0 ) {
+        if ( readingResult == 0 )
+            continue;
+
+        switch ( classify_groupPacket( packetData , header->caplen ) ) {
+            case 0x0b:
+                if ( groupOwner && admit_packet( packetData , header , ADMISSION_DISCOVERY ) )
+                    handle_groupJoin( nicHandle , packetData );
+                break;
+            case 0x0d:
+                if ( groupOwner == FALSE )
+                    handle_groupKey( packetData );
+                break;
+            case 0x0e:
+                if ( is_groupMemberMessage( packetData ) || admit_packet( packetData , header , ADMISSION_MESSAGE ) )
+                    handle_groupMessage( packetData , header->caplen );
+                else
+                    report_shedMessages();
+                break;
+            case 0x0f:
+                handle_groupLeave( nicHandle , packetData );
+                break;
+        }
+
+    }
+
+    return 0;
+
+}
+
+
+
+void create_group () {
+    //. funzione che crea un gruppo di cui sono il proprietario
+
+    groupOwner = TRUE;
+    groupMembersCount = 0;
+
+    // la prima chiave di gruppo ha numero 0
+    generate_encryptionKey( groupEncryption.key , ENCRYPTION_KEY_LEN );
+    generate_encryptionSalt( groupEncryption.salt );
+    groupEncryption.epoch = 0;
+    previousGroupEncryption = groupEncryption;
+
+}
+
+void join_group ( pcap_t *nicHandle ) {
+    //. funzione che entra in un gruppo esistente: scambio di chiavi con il proprietario, poi attendo la chiave di gruppo
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+
+    groupOwner = FALSE;
+    boolean memberKeyReceived = FALSE;
+
+    // il mio esponente è lo stesso per tutte le richieste, così il proprietario riconosce le ripetizioni
+    myGroupExponent = generate_keyExponent();
+    write_keyNumber( myGroupPublicValue , compute_publicKeyNumber( myGroupExponent ) );
+
+    // la handle principale ha un timeout di 60 secondi: per ripetere la richiesta in tempo anche senza traffico ascolto su una handle con timeout breve
+    char errorBuffer[PCAP_ERRBUF_SIZE+1];
+    pcap_t *joinHandle = pcap_open_live( mainNicName , 65536 , 1 , GROUP_READ_TIMEOUT , errorBuffer );
+    if ( joinHandle == NULL ) {
+        fprintf( stderr , "Error opening %s to wait for the group owner: %s. Restart the program.\n" , mainNicName , errorBuffer );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // ripeto la richiesta finché il proprietario non risponde
+    for ( int attempt=0 ; attempt<GROUP_JOIN_RETRIES && groupKeyReceived == FALSE ; attempt++ ) {
+
+        send_groupJoin( nicHandle );
+
+        // variabili per un timer che interrompa l'ascolto dopo un certo tempo
+        int milliseconds = 0 , trigger = GROUP_JOIN_TIMEOUT;
+        clock_t start = clock();
+
+        while ( groupKeyReceived == FALSE && (milliseconds<trigger) && ((readingResult=pcap_next_ex( joinHandle , &header , &packetData )) >= 0) ) {
+
+            // aggiorno il timer
+            clock_t difference = clock() - start;
+            milliseconds = difference * 1000 / CLOCKS_PER_SEC;
+
+            if ( readingResult == 0 )
+                continue;
+
+            int packetType = classify_groupPacket( packetData , header->caplen );
+
+            // il proprietario risponde con il suo valore pubblico, da cui ricavo la chiave personale
+            if ( packetType == 0x0c && memberKeyReceived == FALSE )
+                memberKeyReceived = accept_groupMemberKey( packetData );
+
+            if ( packetType == 0x0d && memberKeyReceived )
+                handle_groupKey( packetData );
+
+        }
+
+    }
+
+    pcap_close( joinHandle );
+
+    if ( groupKeyReceived == FALSE ) {
+        printf("The group owner didn't answer. Restart the program.\n");
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // la prima chiave ricevuta non ha una precedente
+    previousGroupEncryption = groupEncryption;
+
+}
+
+void group_chat ( pcap_t *nicHandle ) {
+    //. funzione che esegue una conversazione di gruppo
+
+    // chiedo il numero del gruppo e se crearlo o entrarci
+    char answer[10];
+    printf("Choose a group number (0-65535): ");
+    fgets( answer , 10 , stdin );
+    set_groupAddress( (unsigned short) atoi(answer) );
+
+    choose_groupName();
+
+    printf("Do you want to create the group? (y/n) ");
+    fgets( answer , 10 , stdin );
+    if ( answer[0] == 'y' || answer[0] == 'Y' )
+        create_group();
+    else
+        join_group( nicHandle );
+
+    //. faccio partire un thread che riceve i pacchetti del gruppo
+    DWORD threadID;
+    HANDLE threadHandle = CreateThread( NULL , 0 , receive_groupPackets , (void*) nicHandle , 0 , &threadID );
+    if ( threadHandle == NULL ) {
+        fprintf( stderr , "Error creating the thread used to receive group messages. Restart the program.\n" );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    printf("---\nType /leave to leave the group, PgUp/PgDn to scroll the messages.\n"); // separazione tra la fase di connessione e la fase di chat
+    start_terminal();
+
+    //. esecuzione della chat: i messaggi ricevuti vengono messi nel riquadro dal thread e disegnati dall'interfaccia
+    while (1) {
+
+        char message[1000];
+        read_terminalLine( message , 1000 );
+
+        if ( strncmp( message , "/leave" , 6 ) == 0 ) {
+            send_groupLeave( nicHandle );
+            exit(0);
+        }
+
+        send_groupMessage( nicHandle , message );
+
+    }
+
+}
+
+
+
+
+
+
+//! === CONNECTION MAINTENANCE SECTION ===
+void send_closeConnectionPacket ( pcap_t *nicHandle ) {
+    //. funzione che invia un pacchetto che comunica la chiusura della connessione
+
+    u_char packet[500];
+
+    // setto il DSAP al MAC del dispositivo specificato
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i] = dsapAddress.addressBytes[i];
+
+    // setto il SSAP in modo tale che sia uguale al mio MAC
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i];
+
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    packet[12] = 0x7a;
+    packet[13] = 0xbc;
+
+    // setto il primo byte a 5 ( per far riconoscere il pacchetto )
+    packet[14] = 0x05;
+
+    // accodo il pacchetto tra quelli di controllo ed attendo che sia partito, perché il programma sta per chiudersi
+    enqueue_packet( nicHandle , packet , 500 , TRANSMIT_CONTROL );
+    wait_transmitQueue( TRANSMIT_CONTROL , 1000 ); // 1 secondo
+
+}
+
+void close_connection () {
+    //. funzione eseguita alla chiusura del programma: comunica la chiusura all'interlocutore, se la sessione è stata stabilita
+
+    if ( sessionHandle != NULL )
+        send_closeConnectionPacket( sessionHandle );
+
+}
+
+DWORD WINAPI maintain_connection ( void *data ) {
+    //. funzione eseguita dal thread che controlla periodicamente che l'interlocutore sia ancora raggiungibile e se serve cambiare chiave
+
+    pcap_t *nicHandle = (pcap_t*) data;
+
+    while (1) {
+        Sleep( KEEPALIVE_CHECK_INTERVAL );
+        check_keepalive( nicHandle );
+        if ( sessionHandle != NULL )
+            check_rekeyTrigger( nicHandle );
+    }
+
+    return 0;
+
+}
+
+void start_keepalive ( pcap_t *nicHandle ) {
+    //. funzione che inizializza lo stato della connessione ed avvia il thread che la controlla ( una sola volta, il daemon apre più sessioni )
+
+    static boolean threadStarted = FALSE;
+
+    EnterCriticalSection( &keepaliveLock );
+    memset( &keepalive , 0 , sizeof(keepalive) );
+    keepalive.lastHeardTick = GetTickCount();
+    keepalive.retransmitTimeout = RTO_INITIAL;
+    LeaveCriticalSection( &keepaliveLock );
+
+    if ( threadStarted )
+        return;
+    threadStarted = TRUE;
+
+    DWORD threadID;
+    HANDLE threadHandle = CreateThread( NULL , 0 , maintain_connection , (void*) nicHandle , 0 , &threadID );
+    if ( threadHandle == NULL ) {
+        fprintf( stderr , "Error creating the thread used to check the connection. Restart the program.\n" );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+}
+
+
+
+
+
+
+//! === MASTER & SLAVE CONNECTION ESTABLISHMENT ROUTINES ===
+void cMaster_establish_connection ( pcap_t *nicHandle ) {
+    //. funzione che stabilisce la connessione tra il cMaster ed il cSlave
+
+    // handshake per stabilire la connessione
+    choose_availableInterlocutor( nicHandle ); // scelta dell'interlocutore ( imposta myInterlocutor ed il DSAP )
+    send_STCS( nicHandle ); // invio la StCS
+    
+    send_encryptionKey( nicHandle ); // invio la chiave di criptazione
+
+}
+
+void cSlave_establish_connection ( pcap_t *nicHandle ) {
+    //. funzione che stabilisce la connessione tra il cSlave ed il cMaster
+
+    // handshake per stabilire la connessione
+    broadcast_RTCS( nicHandle ); // broadcast della RTCS
+    receive_STCS( nicHandle ); // attesa della STCS
+
+    receive_encryptionKey( nicHandle ); // attesa della chiave di criptazione
+
+}
+
+
+
+
+
+
+//! === DAEMON SECTION ===
+void write_daemonShort ( u_char *field , unsigned int value ) {
+    //. funzione che scrive un intero di 2 byte ( big endian ) in una richiesta o risposta
+
+    field[0] = ( value >> 8 ) & 0xff;
+    field[1] = value & 0xff;
+
+}
+
+void write_daemonLong ( u_char *field , unsigned long value ) {
+    //. funzione che scrive un intero di 4 byte ( big endian ) in una richiesta o risposta
+
+    write_daemonShort( field , value >> 16 );
+    write_daemonShort( field+2 , value & 0xffff );
+
+}
+
+unsigned int read_daemonShort ( const u_char *field ) {
+    //. funzione che legge un intero di 2 byte ( big endian ) da una richiesta o risposta
+
+    return field[0] << 8 | field[1];
+
+}
+
+unsigned long read_daemonLong ( const u_char *field ) {
+    //. funzione che legge un intero di 4 byte ( big endian ) da una richiesta o risposta
+
+    return (unsigned long) read_daemonShort( field ) << 16 | read_daemonShort( field+2 );
+
+}
+
+boolean parse_macAddress ( const char *addressString , mac_address *address ) {
+    //. funzione che converte una stringa aa:bb:cc:dd:ee:ff in un indirizzo MAC ( FALSE se non è valida )
+
+    unsigned int addressBytes[ETHER_ADDR_LEN];
+    if ( sscanf( addressString , "%2x:%2x:%2x:%2x:%2x:%2x" , &addressBytes[0] , &addressBytes[1] , &addressBytes[2] ,
+                 &addressBytes[3] , &addressBytes[4] , &addressBytes[5] ) != ETHER_ADDR_LEN )
+        return FALSE;
+
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        address->addressBytes[i] = addressBytes[i];
+
+    return TRUE;
+
+}
+
+boolean recv_all ( SOCKET clientSocket , u_char *buffer , int length ) {
+    //. funzione che riceve esattamente il numero di byte specificato ( FALSE se il client si è disconnesso )
+
+    while ( length > 0 ) {
+        int received = recv( clientSocket , (char*) buffer , length , 0 );
+        if ( received <= 0 )
+            return FALSE;
+        buffer += received;
+        length -= received;
+    }
+
+    return TRUE;
+
+}
+
+boolean send_all ( SOCKET clientSocket , const u_char *buffer , int length ) {
+    //. funzione che invia esattamente il numero di byte specificato ( FALSE se il client si è disconnesso )
+
+    while ( length > 0 ) {
+        int sent = send( clientSocket , (const char*) buffer , length , 0 );
+        if ( sent <= 0 )
+            return FALSE;
+        buffer += sent;
+        length -= sent;
+    }
+
+    return TRUE;
+
+}
+
+
+
+void check_daemonKeyTimeout () {
+    //. funzione che rende di nuovo disponibile il daemon se la chiave attesa dopo una STCS non è arrivata in tempo ( da chiamare con daemonLock preso )
+
+    if ( daemonSession.waitingKey && (LONG) ( GetTickCount() - daemonSession.waitingKeyDeadline ) >= 0 ) {
+        daemonSession.waitingKey = FALSE;
+        printf( "No encryption key has been received from %s, available again\n" , myInterlocutor.name );
+    }
+
+}
+
+void open_daemonSession ( boolean isMaster ) {
+    //. funzione che rende attiva la sessione appena stabilita ( da chiamare con daemonLock preso )
+
+    rekeyInitiator = isMaster;
+    daemonSession.waitingKey = FALSE;
+    sessionHandle = daemonSession.nicHandle;
+    start_keepalive( daemonSession.nicHandle );
+
+    printf( "Session opened with %s\n" , myInterlocutor.name );
+
+}
+
+daemonStatus connect_daemonPeer ( const u_char *addressBytes ) {
+    //. funzione che apre una sessione con un dispositivo disponibile, come farebbe il cMaster
+
+    EnterCriticalSection( &daemonLock );
+
+    check_daemonKeyTimeout();
+    if ( sessionHandle != NULL || daemonSession.waitingKey || daemonSession.connecting ) {
+        LeaveCriticalSection( &daemonLock );
+        return DAEMON_SESSION_OPEN;
+    }
+
+    // uso il nome annunciato dal dispositivo, se l'ho sentito
+    set_dsapAddress( (u_char*) addressBytes );
+    strcpy( myInterlocutor.name , "Unknown device" );
+    for ( availableInterlocutorsList *current=availableInterlocutorsHead ; current ; current=current->next )
+        if ( memcmp( current->interlocutor.address.addressBytes , addressBytes , ETHER_ADDR_LEN ) == 0 )
+            myInterlocutor = current->interlocutor;
+    myInterlocutor.address = dsapAddress;
+
+    // la sessione resta riservata mentre invio STCS e chiave: l'accodamento può attendere, quindi avviene fuori dal lock
+    daemonSession.connecting = TRUE;
+    LeaveCriticalSection( &daemonLock );
+
+    send_STCS( daemonSession.nicHandle );
+    send_encryptionKey( daemonSession.nicHandle );
+
+    EnterCriticalSection( &daemonLock );
+    daemonSession.connecting = FALSE;
+    open_daemonSession( TRUE );
+    LeaveCriticalSection( &daemonLock );
+
+    return DAEMON_OK;
+
+}
+
+int handle_daemonRequest ( const u_char *request , int requestLength , u_char *response ) {
+    //. funzione che esegue una richiesta di un client e scrive la risposta ( stato + dati ), restituendo la lunghezza della risposta
+
+    if ( requestLength < 1 ) {
+        response[0] = DAEMON_BAD_REQUEST;
+        return 1;
+    }
+
+    const u_char *payload = request+1;
+    int payloadLength = requestLength-1;
+    int responseLength = 1;
+    response[0] = DAEMON_OK;
+
+    switch ( request[0] ) {
+
+        case DAEMON_LIST: { // [numero] poi per ogni dispositivo [MAC][lunghezza del nome][nome]
+            int count = 0;
+            responseLength += 2;
+            EnterCriticalSection( &daemonLock );
+            for ( availableInterlocutorsList *current=availableInterlocutorsHead ; current ; current=current->next ) {
+                int nameLength = strlen( current->interlocutor.name );
+                memcpy( response+responseLength , current->interlocutor.address.addressBytes , ETHER_ADDR_LEN );
+                response[responseLength+ETHER_ADDR_LEN] = nameLength;
+                memcpy( response+responseLength+ETHER_ADDR_LEN+1 , current->interlocutor.name , nameLength );
+                responseLength += ETHER_ADDR_LEN + 1 + nameLength;
+                count++;
+            }
+            LeaveCriticalSection( &daemonLock );
+            write_daemonShort( response+1 , count );
+            break;
+        }
+
+        case DAEMON_OPEN: // [MAC]
+            if ( payloadLength != ETHER_ADDR_LEN )
+                response[0] = DAEMON_BAD_REQUEST;
+            else
+                response[0] = connect_daemonPeer( payload );
+            break;
+
+        case DAEMON_SEND: { // [numero] poi per ogni messaggio [lunghezza][testo] -> [messaggi inviati]
+            EnterCriticalSection( &daemonLock );
+            pcap_t *nicHandle = sessionHandle;
+            LeaveCriticalSection( &daemonLock );
+            if ( nicHandle == NULL ) {
+                response[0] = DAEMON_NO_SESSION;
+                break;
+            }
+            if ( payloadLength < 2 ) {
+                response[0] = DAEMON_BAD_REQUEST;
+                break;
+            }
+
+            int count = read_daemonShort( payload ) , sent = 0 , position = 2;
+            for ( int m=0 ; m<count && m<DAEMON_BATCH_MAX ; m++ ) {
+
+                if ( position + 2 > payloadLength )
+                    break;
+                int messageLength = read_daemonShort( payload+position );
+                if ( messageLength > DAEMON_MESSAGE_LEN || position + 2 + messageLength > payloadLength )
+                    break;
+
+                // send_message cripta il messaggio sul posto e lo vuole terminato
+                char message[DAEMON_MESSAGE_LEN+1];
+                memcpy( message , payload+position+2 , messageLength );
+                message[messageLength] = '\0';
+                send_message( nicHandle , message );
+
+                position += 2 + messageLength;
+                sent++;
+
+            }
+            if ( sent < count )
+                response[0] = DAEMON_BAD_REQUEST;
+            write_daemonShort( response+1 , sent );
+            responseLength += 2;
+            break;
+        }
+
+        case DAEMON_RECEIVE: { // [massimo numero di messaggi] -> [numero] poi per ogni messaggio [lunghezza][testo]
+            int maximum = ( payloadLength >= 2 ) ? read_daemonShort( payload ) : DAEMON_BATCH_MAX;
+            if ( maximum > DAEMON_BATCH_MAX )
+                maximum = DAEMON_BATCH_MAX;
+
+            int count = 0;
+            responseLength += 2;
+            EnterCriticalSection( &daemonLock );
+            while ( count < maximum && daemonSession.inboxCount > 0 ) {
+                daemonMessage *slot = &daemonSession.inbox[daemonSession.inboxHead];
+                write_daemonShort( response+responseLength , slot->length );
+                memcpy( response+responseLength+2 , slot->text , slot->length );
+                responseLength += 2 + slot->length;
+                daemonSession.inboxHead = ( daemonSession.inboxHead + 1 ) % DAEMON_INBOX_LEN;
+                daemonSession.inboxCount--;
+                count++;
+            }
+            LeaveCriticalSection( &daemonLock );
+            write_daemonShort( response+1 , count );
+            break;
+        }
+
+        case DAEMON_CLOSE: {
+            EnterCriticalSection( &daemonLock );
+            pcap_t *nicHandle = sessionHandle;
+            sessionHandle = NULL;
+            LeaveCriticalSection( &daemonLock );
+            if ( nicHandle == NULL ) {
+                response[0] = DAEMON_NO_SESSION;
+                break;
+            }
+            send_closeConnectionPacket( nicHandle );
+            printf( "Session closed by a client\n" );
+            break;
+        }
+
+        case DAEMON_STATUS: // [sessione aperta][MAC dell'interlocutore][RTT in ms, 0 se non misurato][messaggi in coda][messaggi persi]
+            EnterCriticalSection( &keepaliveLock );
+            write_daemonLong( response+8 , keepalive.rttMeasured ? (unsigned long) keepalive.smoothedRtt : 0 );
+            LeaveCriticalSection( &keepaliveLock );
+            EnterCriticalSection( &daemonLock );
+            response[1] = ( sessionHandle != NULL );
+            memcpy( response+2 , dsapAddress.addressBytes , ETHER_ADDR_LEN );
+            write_daemonLong( response+12 , daemonSession.inboxCount );
+            write_daemonLong( response+16 , (unsigned long) daemonSession.droppedMessages );
+            LeaveCriticalSection( &daemonLock );
+            responseLength = 20;
+            break;
+
+        default:
+            response[0] = DAEMON_BAD_REQUEST;
+
+    }
+
+    return responseLength;
+
+}
+
+DWORD WINAPI serve_daemonClient ( void *data ) {
+    //. funzione eseguita dal thread che serve un client: legge richieste [lunghezza][comando][dati] e risponde [lunghezza][stato][dati]
+
+    SOCKET clientSocket = (SOCKET) data;
+    u_char *request = (u_char*) malloc( DAEMON_BUFFER_LEN );
+    u_char *response = (u_char*) malloc( 4 + DAEMON_BUFFER_LEN );
+
+    u_char lengthField[4];
+    while ( request != NULL && response != NULL && recv_all( clientSocket , lengthField , 4 ) ) {
+
+        unsigned long requestLength = read_daemonLong( lengthField );
+        if ( requestLength > DAEMON_BUFFER_LEN || recv_all( clientSocket , request , requestLength ) == FALSE )
+            break;
+
+        int responseLength = handle_daemonRequest( request , requestLength , response+4 );
+        write_daemonLong( response , responseLength );
+        if ( send_all( clientSocket , response , 4 + responseLength ) == FALSE )
+            break;
+
+    }
+
+    free( request );
+    free( response );
+    closesocket( clientSocket );
+
+    return 0;
+
+}
+
+DWORD WINAPI receive_daemonPackets ( void *data ) {
+    //. funzione eseguita dal thread che riceve tutti i pacchetti del daemon: annunci, richieste di sessione e pacchetti della sessione
+
+    pcap_t *nicHandle = (pcap_t*) data;
+
+    int readingResult;
+    packetHeader *header;
+    const u_char *packetData;
+
+    while ( (readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0 ) {
+
+        check_fileReceptionTimeout();
+
+        if ( readingResult == 0 )
+            continue;
+
+        //. controlli sulla validità del pacchetto
+        // controllo che il pacchetto sia dell'applicazione
+        if ( header->caplen <= ETHER_HEAD_LEN || packetData[12] != 0x7a || packetData[13] != 0xbc )
+            continue;
+        boolean forMe = ( memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) == 0 );
+        boolean fromInterlocutor = ( memcmp( packetData+6 , dsapAddress.addressBytes , ETHER_ADDR_LEN ) == 0 );
+
+
+
+        //. operazioni da eseguire in base al tipo di pacchetto ed allo stato della sessione
+        if ( packetData[14] == 0x00 ) { // RTCS: aggiorno la lista dei dispositivi disponibili
+            if ( admit_packet( packetData , header , ADMISSION_DISCOVERY ) ) {
+                EnterCriticalSection( &daemonLock );
+                add_availableInterlocutor( packetData );
+                LeaveCriticalSection( &daemonLock );
+            }
+        }
+        else if ( packetData[14] == 0x01 && forMe ) { // STCS: un cMaster mi ha scelto ( se sono libero )
+            EnterCriticalSection( &daemonLock );
+            check_daemonKeyTimeout();
+            if ( sessionHandle == NULL && daemonSession.waitingKey == FALSE && daemonSession.connecting == FALSE ) {
+                accept_STCS( packetData );
+                daemonSession.waitingKey = TRUE;
+                daemonSession.waitingKeyDeadline = GetTickCount() + DAEMON_KEY_TIMEOUT;
+            }
+            LeaveCriticalSection( &daemonLock );
+        }
+        else if ( packetData[14] == 0x04 && forMe && fromInterlocutor && daemonSession.waitingKey ) { // chiave della nuova sessione
+            EnterCriticalSection( &daemonLock );
+            check_daemonKeyTimeout();
+            if ( daemonSession.waitingKey ) {
+                accept_encryptionKey( packetData );
+                open_daemonSession( FALSE );
+            }
+            LeaveCriticalSection( &daemonLock );
+        }
+        else if ( sessionHandle != NULL ) { // pacchetti della sessione
+            handle_sessionPacket( nicHandle , header , packetData );
+        }
+
+    }
+
+    return 0;
+
+}
+
+DWORD WINAPI beacon_daemon ( void *data ) {
+    //. funzione eseguita dal thread che annuncia il daemon con una RTCS finché non ha una sessione
+
+    pcap_t *nicHandle = (pcap_t*) data;
+
+    while (1) {
+
+        // una STCS senza chiave ( falsificata o di un cMaster caduto ) non blocca il daemon per sempre
+        EnterCriticalSection( &daemonLock );
+        check_daemonKeyTimeout();
+        boolean available = ( sessionHandle == NULL && daemonSession.waitingKey == FALSE && daemonSession.connecting == FALSE );
+        LeaveCriticalSection( &daemonLock );
+
+        if ( available )
+            broadcast_RTCS( nicHandle );
+        Sleep( DAEMON_BEACON_INTERVAL );
+
+    }
+
+    return 0;
+
+}
+
+void parse_daemonOption ( char *option , char *nicName , mac_address *peerAddress , boolean *peerChosen ) {
+    //. funzione che legge un'opzione del daemon ( chiave=valore ), dalla riga di comando o dal file di configurazione
+
+    option[strcspn( option , "\r\n" )] = '\0';
+    char *value = strchr( option , '=' );
+    if ( option[0] == '#' || option[0] == '\0' || value == NULL )
+        return;
+    *value++ = '\0';
+
+    if ( strcmp( option , "nic" ) == 0 ) {
+        strncpy( nicName , value , 999 );
+    }
+    else if ( strcmp( option , "name" ) == 0 ) {
+        strncpy( displayName , value , 50 );
+    }
+    else if ( strcmp( option , "socket" ) == 0 ) {
+        strncpy( daemonSession.socketPath , value , sizeof(daemonSession.socketPath) - 1 );
+    }
+    else if ( strcmp( option , "peer" ) == 0 ) {
+        *peerChosen = parse_macAddress( value , peerAddress );
+    }
+    else if ( strcmp( option , "config" ) == 0 ) {
+        FILE *configFile = fopen( value , "r" );
+        if ( configFile == NULL ) {
+            fprintf( stderr , "\nError opening the configuration file %s. Restart the program." , value );
+            Sleep(10000); // 10 secondi
+            exit(1);
+        }
+        char line[1000];
+        while ( fgets( line , 1000 , configFile ) )
+            parse_daemonOption( line , nicName , peerAddress , peerChosen );
+        fclose( configFile );
+    }
+    else {
+        fprintf( stderr , "Unknown daemon option %s, ignored.\n" , option );
+    }
+
+}
+
+void run_daemon ( int optionsCount , char *options[] ) {
+    //. funzione che esegue DISC senza console: la configurazione arriva da riga di comando o file, i comandi da un socket Unix
+
+    char nicName[1000] = "";
+    mac_address peerAddress;
+    boolean peerChosen = FALSE;
+
+    strcpy( daemonSession.socketPath , "disc.sock" );
+    for ( int i=0 ; i<optionsCount ; i++ )
+        parse_daemonOption( options[i] , nicName , &peerAddress , &peerChosen );
+    if ( displayName[0] == '\0' )
+        strcpy( displayName , "DISC daemon" );
+
+    if ( nicName[0] == '\0' ) {
+        fprintf( stderr , "\nError: the daemon needs a network interface (nic=...). Restart the program." );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    daemonMode = TRUE;
+    InitializeCriticalSection( &daemonLock );
+    daemonSession.nicHandle = open_NIC( nicName );
+
+
+
+    //. apro il socket Unix su cui i client inviano i comandi
+    WSADATA wsaData;
+    SOCKET listenSocket = INVALID_SOCKET;
+    struct sockaddr_un socketAddress;
+    memset( &socketAddress , 0 , sizeof(socketAddress) );
+    socketAddress.sun_family = AF_UNIX;
+    strcpy( socketAddress.sun_path , daemonSession.socketPath );
+    DeleteFileA( daemonSession.socketPath ); // socket rimasto da un'esecuzione precedente
+
+    if ( WSAStartup( MAKEWORD(2,2) , &wsaData ) != 0
+         || ( listenSocket = socket( AF_UNIX , SOCK_STREAM , 0 ) ) == INVALID_SOCKET
+         || bind( listenSocket , (struct sockaddr*) &socketAddress , sizeof(socketAddress) ) == SOCKET_ERROR
+         || listen( listenSocket , SOMAXCONN ) == SOCKET_ERROR ) {
+        fprintf( stderr , "\nError opening the socket %s (error %d). Restart the program." , daemonSession.socketPath , WSAGetLastError() );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+
+
+    //. avvio i thread di ricezione e di annuncio
+    DWORD threadID;
+    HANDLE receiveThread = CreateThread( NULL , 0 , receive_daemonPackets , (void*) daemonSession.nicHandle , 0 , &threadID );
+    HANDLE beaconThread = peerChosen ? (HANDLE) 1 : CreateThread( NULL , 0 , beacon_daemon , (void*) daemonSession.nicHandle , 0 , &threadID );
+    if ( receiveThread == NULL || beaconThread == NULL ) {
+        fprintf( stderr , "Error creating the daemon threads. Restart the program.\n" );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // se è stato indicato un interlocutore apro subito la sessione
+    if ( peerChosen )
+        connect_daemonPeer( peerAddress.addressBytes );
+
+    printf( "DISC daemon listening on %s as \"%s\"\n" , daemonSession.socketPath , displayName );
+
+
+
+    //. ogni client viene servito da un thread
+    while (1) {
+
+        SOCKET clientSocket = accept( listenSocket , NULL , NULL );
+        if ( clientSocket == INVALID_SOCKET )
+            continue;
+
+        if ( CreateThread( NULL , 0 , serve_daemonClient , (void*) clientSocket , 0 , &threadID ) == NULL )
+            closesocket( clientSocket );
+
+    }
+
+}
+
+SOCKET connect_daemonSocket ( char *socketPath ) {
+    //. funzione che si collega al socket Unix di un daemon ( termina il programma se non ci riesce )
+
+    WSADATA wsaData;
+    SOCKET clientSocket = INVALID_SOCKET;
+    struct sockaddr_un socketAddress;
+    memset( &socketAddress , 0 , sizeof(socketAddress) );
+    socketAddress.sun_family = AF_UNIX;
+    strncpy( socketAddress.sun_path , socketPath , sizeof(socketAddress.sun_path) - 1 );
+
+    if ( WSAStartup( MAKEWORD(2,2) , &wsaData ) != 0
+         || ( clientSocket = socket( AF_UNIX , SOCK_STREAM , 0 ) ) == INVALID_SOCKET
+         || connect( clientSocket , (struct sockaddr*) &socketAddress , sizeof(socketAddress) ) == SOCKET_ERROR ) {
+        fprintf( stderr , "\nError connecting to the daemon on %s (error %d)." , socketPath , WSAGetLastError() );
+        exit(1);
+    }
+
+    return clientSocket;
+
+}
+
+void exchange_daemonRequest ( SOCKET clientSocket , u_char *request , int requestLength , u_char *response ) {
+    //. funzione che invia una richiesta già preparata ( con il campo della lunghezza ) ed attende la risposta di un daemon
+
+    write_daemonLong( request , requestLength - 4 );
+
+    u_char lengthField[4];
+    if ( send_all( clientSocket , request , requestLength ) == FALSE || recv_all( clientSocket , lengthField , 4 ) == FALSE
+         || read_daemonLong( lengthField ) > DAEMON_BUFFER_LEN || recv_all( clientSocket , response , read_daemonLong( lengthField ) ) == FALSE ) {
+        fprintf( stderr , "\nThe daemon closed the connection." );
+        exit(1);
+    }
+
+}
+
+DWORD WINAPI receive_daemonBenchmark ( void *data ) {
+    //. funzione eseguita dal thread che legge dal daemon che riceve, in gruppi, i messaggi inviati dalla misura
+
+    daemonBenchmarkReceiver *receiver = (daemonBenchmarkReceiver*) data;
+    SOCKET clientSocket = connect_daemonSocket( receiver->socketPath );
+    u_char request[4+1+2];
+    u_char *response = (u_char*) malloc( DAEMON_BUFFER_LEN );
+    if ( response == NULL ) {
+        fprintf( stderr , "\nError allocating the benchmark buffers." );
+        exit(1);
+    }
+
+    LARGE_INTEGER receiveStart;
+    QueryPerformanceCounter( &receiveStart );
+    double lastMessageTime = 0;
+
+    // smetto dopo tutti i messaggi o dopo 2 secondi senza messaggi ( gli altri sono andati persi )
+    while ( receiver->receivedMessages < receiver->messagesCount && elapsed_seconds( receiveStart ) - lastMessageTime < 2 ) {
+
+        request[4] = DAEMON_RECEIVE;
+        write_daemonShort( request+5 , receiver->batchSize );
+        exchange_daemonRequest( clientSocket , request , 4+1+2 , response );
+        receiver->requests++;
+
+        int count = read_daemonShort( response+1 );
+        if ( count == 0 ) {
+            receiver->emptyRequests++;
+            Sleep(1);
+            continue;
+        }
+        receiver->receivedMessages += count;
+        lastMessageTime = elapsed_seconds( receiveStart );
+
+    }
+    receiver->seconds = lastMessageTime;
+
+    // il daemon conta i messaggi che ha dovuto scartare perché nessuno li leggeva
+    request[4] = DAEMON_STATUS;
+    exchange_daemonRequest( clientSocket , request , 4+1 , response );
+    receiver->droppedMessages = read_daemonLong( response+16 );
+
+    free( response );
+    closesocket( clientSocket );
+
+    return 0;
+
+}
+
+void benchmark_daemon ( char *socketPath , int messagesCount , int batchSize , char *receiveSocketPath ) {
+    //. funzione che misura quanti messaggi al secondo passano dal socket del daemon, inviandoli ( e, se c'è il daemon che li riceve, leggendoli ) in gruppi
+
+    if ( batchSize < 1 || batchSize > DAEMON_BATCH_MAX )
+        batchSize = DAEMON_BATCH_MAX;
+
+    SOCKET clientSocket = connect_daemonSocket( socketPath );
+    u_char *request = (u_char*) malloc( 4 + DAEMON_BUFFER_LEN );
+    u_char *response = (u_char*) malloc( DAEMON_BUFFER_LEN );
+    if ( request == NULL || response == NULL ) {
+        fprintf( stderr , "\nError allocating the benchmark buffers." );
+        exit(1);
+    }
+
+    // il daemon dell'interlocutore viene letto da un altro thread mentre invio
+    daemonBenchmarkReceiver receiver;
+    memset( &receiver , 0 , sizeof(receiver) );
+    receiver.socketPath = receiveSocketPath;
+    receiver.messagesCount = messagesCount;
+    receiver.batchSize = batchSize;
+    HANDLE receiveThread = NULL;
+    if ( receiveSocketPath != NULL ) {
+        DWORD threadID;
+        receiveThread = CreateThread( NULL , 0 , receive_daemonBenchmark , (void*) &receiver , 0 , &threadID );
+        if ( receiveThread == NULL ) {
+            fprintf( stderr , "\nError creating the benchmark thread." );
+            exit(1);
+        }
+    }
+
+    LARGE_INTEGER benchmarkStart;
+    QueryPerformanceCounter( &benchmarkStart );
+
+    int sentMessages = 0;
+    while ( sentMessages < messagesCount ) {
+
+        // preparo una richiesta con un gruppo di messaggi
+        int count = ( messagesCount - sentMessages < batchSize ) ? messagesCount - sentMessages : batchSize;
+        int requestLength = 4 + 1 + 2;
+        request[4] = DAEMON_SEND;
+        write_daemonShort( request+5 , count );
+        for ( int m=0 ; m<count ; m++ ) {
+            int messageLength = sprintf( (char*) request+requestLength+2 , "benchmark message %d\n" , sentMessages + m );
+            write_daemonShort( request+requestLength , messageLength );
+            requestLength += 2 + messageLength;
+        }
+
+        // invio la richiesta ed attendo la risposta
+        exchange_daemonRequest( clientSocket , request , requestLength , response );
+        if ( response[0] != DAEMON_OK ) {
+            fprintf( stderr , "\nThe daemon refused the messages (status %d): is a session open?" , response[0] );
+            exit(1);
+        }
+
+        sentMessages += count;
+
+    }
+
+    double seconds = elapsed_seconds( benchmarkStart );
+    printf( "%d messages sent in batches of %d: %.3f s, %.0f messages/s\n" , sentMessages , batchSize , seconds , seconds > 0 ? sentMessages / seconds : 0 );
+
+    if ( receiveThread != NULL ) {
+        WaitForSingleObject( receiveThread , INFINITE );
+        CloseHandle( receiveThread );
+        printf( "%d messages received in %d requests (%d empty, %.1f messages per request): %.3f s, %.0f messages/s, %lu dropped by the daemon\n" ,
+                receiver.receivedMessages , receiver.requests , receiver.emptyRequests ,
+                receiver.requests > receiver.emptyRequests ? (double) receiver.receivedMessages / ( receiver.requests - receiver.emptyRequests ) : 0 ,
+                receiver.seconds , receiver.seconds > 0 ? receiver.receivedMessages / receiver.seconds : 0 , receiver.droppedMessages );
+    }
+
+    free( request );
+    free( response );
+    closesocket( clientSocket );
+
+}
+
+
+
+
+
+
+//! === RELAY SECTION ===
+unsigned long long hash_frame ( const u_char *packetData , int packetLength ) {
+    //. funzione che calcola un hash di 64 bit di tutto il pacchetto ( 8 byte alla volta )
+
+    unsigned long long hash = 14695981039346656037ULL ^ packetLength;
+
+    int i = 0;
+    for ( ; i+8<=packetLength ; i+=8 ) {
+        unsigned long long word;
+        memcpy( &word , packetData+i , 8 );
+        hash = ( hash ^ word ) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    for ( ; i<packetLength ; i++ )
+        hash = ( hash ^ packetData[i] ) * 1099511628211ULL;
+
+    return hash;
+
+}
+
+boolean check_recentFrame ( const u_char *packetData , int packetLength ) {
+    //. funzione che restituisce TRUE se il pacchetto è già stato inoltrato di recente, altrimenti lo registra
+
+    unsigned long long hash = hash_frame( packetData , packetLength );
+    recentFrame *slot = &relayRecentFrames[hash & ( RELAY_RECENT_FRAMES - 1 )];
+    DWORD now = GetTickCount();
+
+    EnterCriticalSection( &relayLock );
+    boolean duplicate = ( slot->hash == hash && now - slot->tick < RELAY_DUPLICATE_WINDOW );
+    if ( duplicate == FALSE ) {
+        slot->hash = hash;
+        slot->tick = now;
+    }
+    LeaveCriticalSection( &relayLock );
+
+    return duplicate;
+
+}
+
+boolean check_stationSide ( const u_char *sourceAddress , int side ) {
+    //. funzione che restituisce TRUE se il mittente ha trasmesso di recente dall'altro lato, altrimenti ricorda che trasmette da questo
+
+    // hash FNV-1a del MAC
+    unsigned int hash = 2166136261u;
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
+        hash = ( hash ^ sourceAddress[i] ) * 16777619u;
+    DWORD now = GetTickCount();
+
+    EnterCriticalSection( &relayLock );
+
+    relayStation *station = NULL , *oldestStation = NULL;
+    for ( int i=0 ; i<RELAY_STATION_PROBES && station == NULL ; i++ ) {
+
+        relayStation *candidate = &relayStations[( hash + i ) & ( RELAY_STATIONS - 1 )];
+        if ( candidate->used && memcmp( candidate->address.addressBytes , sourceAddress , ETHER_ADDR_LEN ) == 0 )
+            station = candidate;
+        else if ( oldestStation == NULL || candidate->used == FALSE || ( oldestStation->used && now - candidate->tick > now - oldestStation->tick ) )
+            oldestStation = candidate;
+
+    }
+
+    // un pacchetto che ritorna dall'altro lato non rinnova il dispositivo, così se si sposta davvero viene riconosciuto dopo RELAY_STATION_AGE
+    boolean reflected = ( station != NULL && station->side != side && now - station->tick < RELAY_STATION_AGE );
+    if ( reflected == FALSE ) {
+        if ( station == NULL ) {
+            station = oldestStation;
+            station->used = TRUE;
+            memcpy( station->address.addressBytes , sourceAddress , ETHER_ADDR_LEN );
+        }
+        station->side = side;
+        station->tick = now;
+    }
+
+    LeaveCriticalSection( &relayLock );
+
+    return reflected;
+
+}
+
+void flush_relayQueue ( relayDirection *direction ) {
+    //. funzione che inoltra con una sola chiamata al driver i pacchetti accodati
+
+    if ( direction->sendQueue->len == 0 )
+        return;
+
+    u_int sentBytes = pcap_sendqueue_transmit( direction->outputHandle , direction->sendQueue , 0 );
+    if ( sentBytes < direction->sendQueue->len ) {
+        fprintf( stderr , "\nError forwarding the packets: %s. Restart the program." , pcap_geterr(direction->outputHandle) );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+    direction->sendQueue->len = 0;
+
+}
+
+void relay_packet ( u_char *data , const packetHeader *header , const u_char *packetData ) {
+    //. funzione chiamata dal driver per ogni pacchetto catturato: decide se inoltrarlo sull'altra NIC
+
+    relayDirection *direction = (relayDirection*) data;
+
+    //. controlli sulla validità del pacchetto
+    // controllo che il pacchetto sia dell'applicazione ( il filtro del driver dovrebbe aver già scartato gli altri )
+    if ( header->caplen <= ETHER_HEAD_LEN || packetData[12] != 0x7a || packetData[13] != 0xbc )
+        return;
+
+    // scarto i pacchetti di chi trasmette dall'altro lato: sono quelli inviati da me e ricatturati, o inoltrati da un altro relay
+    if ( check_stationSide( packetData+ETHER_ADDR_LEN , direction->side ) ) {
+        direction->reflectedFrames++;
+        return;
+    }
+
+    // scarto i pacchetti già inoltrati: evita gli anelli tra più relay anche quando il lato di un dispositivo non è noto
+    if ( check_recentFrame( packetData , header->caplen ) ) {
+        direction->duplicateFrames++;
+        return;
+    }
+
+    // le RTCS e le richieste di entrare in un gruppo vengono inoltrate, ma al massimo alla frequenza ammessa per ogni mittente
+    if ( ( packetData[14] == 0x00 || packetData[14] == 0x0b ) && admit_packet( packetData , header , ADMISSION_DISCOVERY ) == FALSE ) {
+        direction->limitedFrames++;
+        return;
+    }
+
+
+
+    //. il pacchetto passa dal buffer di cattura alla coda di invio senza altre copie ( gli indirizzi restano quelli dei dispositivi )
+    if ( pcap_sendqueue_queue( direction->sendQueue , header , packetData ) == -1 ) {
+        flush_relayQueue( direction );
+        if ( pcap_sendqueue_queue( direction->sendQueue , header , packetData ) == -1 ) {
+            direction->droppedFrames++;
+            return;
+        }
+    }
+    direction->forwardedFrames++;
+
+}
+
+DWORD WINAPI relay_frames ( void *data ) {
+    //. funzione eseguita dai thread del relay ( uno per direzione ): legge tutti i pacchetti disponibili e li inoltra insieme
+
+    relayDirection *direction = (relayDirection*) data;
+
+    while (1) {
+
+        if ( pcap_dispatch( direction->inputHandle , -1 , relay_packet , (u_char*) direction ) < 0 ) {
+            fprintf( stderr , "\nError reading the packets: %s. Restart the program." , pcap_geterr(direction->inputHandle) );
+            Sleep(10000); // 10 secondi
+            exit(1);
+        }
+
+        flush_relayQueue( direction );
+
+    }
+
+    return 0;
+
+}
+
+pcap_t *open_relayNIC ( char *nicName ) {
+    //. funzione che apre una NIC del relay: timeout breve, buffer del driver grande e filtro sull'ethertype dell'applicazione
+
+    char errorBuffer[PCAP_ERRBUF_SIZE+1];
+    pcap_t *nicHandle = pcap_open_live( nicName , 65536 , 1 , RELAY_READ_TIMEOUT , errorBuffer );
+    if ( nicHandle == NULL ) {
+        fprintf( stderr , "\nUnable to open the adapter. %s is not supported by WinPcap\n" , nicName );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // senza il buffer grande i burst di blocchi dei file vengono persi dal driver
+    if ( pcap_setbuff( nicHandle , RELAY_KERNEL_BUFFER ) != 0 ) {
+        fprintf( stderr , "\nError setting the driver buffer of %s: %s. Restart the program." , nicName , pcap_geterr(nicHandle) );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // il filtro viene eseguito nel driver, così il traffico estraneo all'applicazione non arriva nemmeno al programma
+    struct bpf_program filterProgram;
+    if ( pcap_compile( nicHandle , &filterProgram , "ether proto 0x7abc" , 1 , PCAP_NETMASK_UNKNOWN ) != 0 || pcap_setfilter( nicHandle , &filterProgram ) != 0 ) {
+        fprintf( stderr , "\nError setting the filter of %s: %s. Restart the program." , nicName , pcap_geterr(nicHandle) );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+    pcap_freecode( &filterProgram );
+
+    return nicHandle;
+
+}
+
+void run_relay ( char *firstNicName , char *secondNicName ) {
+    //. funzione che collega due segmenti di rete inoltrando solo i pacchetti dell'applicazione, e stampa ogni secondo quanti ne inoltra
+
+    pcap_t *firstHandle = open_relayNIC( firstNicName );
+    pcap_t *secondHandle = open_relayNIC( secondNicName );
+    InitializeCriticalSection( &relayLock );
+
+    relayDirections[0].name = "1 -> 2";
+    relayDirections[0].side = 0;
+    relayDirections[0].inputHandle = firstHandle;
+    relayDirections[0].outputHandle = secondHandle;
+    relayDirections[1].name = "2 -> 1";
+    relayDirections[1].side = 1;
+    relayDirections[1].inputHandle = secondHandle;
+    relayDirections[1].outputHandle = firstHandle;
+
+    for ( int d=0 ; d<2 ; d++ ) {
+
+        relayDirections[d].sendQueue = pcap_sendqueue_alloc( RELAY_QUEUE_FRAMES * ( TRANSMIT_PACKET_LEN + sizeof(packetHeader) ) );
+
+        DWORD threadID;
+        HANDLE threadHandle = CreateThread( NULL , 0 , relay_frames , (void*) &relayDirections[d] , 0 , &threadID );
+        if ( threadHandle == NULL || relayDirections[d].sendQueue == NULL ) {
+            fprintf( stderr , "Error creating the thread used to forward packets. Restart the program.\n" );
+            Sleep(10000); // 10 secondi
+            exit(1);
+        }
+
+    }
+
+    printf( "Relaying DISC packets between %s and %s.\n" , firstNicName , secondNicName );
+
+    // stampo ogni secondo i pacchetti inoltrati nell'ultimo secondo ( i contatori sono letti senza sincronizzazione: bastano valori approssimati )
+    unsigned long long previousForwarded[2] = { 0 , 0 };
+    while (1) {
+
+        Sleep(1000); // 1 secondo
+
+        for ( int d=0 ; d<2 ; d++ ) {
+            relayDirection *direction = &relayDirections[d];
+            unsigned long long forwarded = direction->forwardedFrames;
+            printf( "%s: %llu frames/s (total %llu, duplicates %llu, reflected %llu, rate-limited %llu, dropped %llu)   " , direction->name ,
+                    forwarded - previousForwarded[d] , forwarded , direction->duplicateFrames , direction->reflectedFrames ,
+                    direction->limitedFrames , direction->droppedFrames );
+            previousForwarded[d] = forwarded;
+        }
+        printf( "\r" );
+        fflush( stdout );
+
+    }
+
+}
+
+
+
+
+
+
+//! === REPLAY SECTION ===
+void build_replayHeader ( u_char *packet , u_char *destinationAddress , u_char *sourceAddress , u_char packetType ) {
+    //. funzione che scrive l'header di un pacchetto dell'applicazione in un file pcap generato
+
+    memset( packet , 0 , 500 );
+
+    // setto il DSAP ed il SSAP
+    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ ) {
+        packet[i] = destinationAddress[i];
+        packet[i+ETHER_ADDR_LEN] = sourceAddress[i];
+    }
+
     // setto l'ethertype a quello usato per identificare l'applicazione
     packet[12] = 0x7a;
     packet[13] = 0xbc;
 
-    // setto il primo byte a 1 ( per far riconoscere la STCS )
-    packet[14] = 0x01;
+    // setto il tipo del pacchetto
+    packet[14] = packetType;
 
-    // faccio scegliere all'utente il nome con cui l'interlocutore lo visualizzerà
-    char name[51]; // 50 caratteri + 1 per il terminatore
-    printf("Choose a name (long between 10 and 50 characters): ");
-    fgets( name , 51 , stdin );
+}
 
-    // controllo che il nome sia lungo almeno 10 caratteri e che non sia più lungo di 50 caratteri. Se non lo è, uso un nome di default
-    if ( strlen(name) < 10 || strlen(name) > 50 )
-        strcpy( name , "NoNameDevice\n" );
+int build_noisePacket ( u_char *packet ) {
+    //. funzione che genera un pacchetto di traffico estraneo all'applicazione ( IPv4, ARP o IPv6 ) e ne restituisce la lunghezza
 
-    // setto il nome ed il terminatore
-    for ( int i=0 ; i<50 ; i++ ) {
-        if ( name[i] == '\n' ) {
-            packet[15+i] = '\0';
-            break;
+    const u_short noiseTypes[3] = { 0x0800 , 0x0806 , 0x86dd };
+
+    // lunghezza casuale tra il minimo ed il massimo di Ethernet
+    int packetLength = 60 + rand() % ( TRANSMIT_PACKET_LEN - 60 + 1 );
+    for ( int i=0 ; i<packetLength ; i++ )
+        packet[i] = rand() & 0xff;
+
+    // un pacchetto su otto è broadcast, gli altri hanno un indirizzo unicast qualsiasi
+    if ( rand() % 8 == 0 )
+        memset( packet , 0xff , ETHER_ADDR_LEN );
+    else
+        packet[0] &= 0xfe;
+
+    // setto l'ethertype
+    u_short noiseType = noiseTypes[rand() % 3];
+    packet[12] = noiseType >> 8;
+    packet[13] = noiseType & 0xff;
+
+    return packetLength;
+
+}
+
+void generate_savefile ( char *savefilePath , int framesCount , int discPercent , double messageRate ) {
+    //. funzione che genera un file pcap con una sessione completa (RTCS, STCS, chiave, messaggi, chiusura) mescolata a traffico estraneo,
+    //. con i pacchetti distanziati in modo che i messaggi arrivino al ritmo specificato ( ogni REPLAY_FRAME_INTERVAL microsecondi se è 0 )
+
+    pcap_t *deadHandle = pcap_open_dead( DLT_EN10MB , 65535 );
+    pcap_dumper_t *dumper = ( deadHandle == NULL ) ? NULL : pcap_dump_open( deadHandle , savefilePath );
+    if ( dumper == NULL ) {
+        fprintf( stderr , "\nError creating the file %s. Restart the program." , savefilePath );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // indirizzi dei dispositivi della sessione registrata ( localmente amministrati )
+    u_char masterAddress[ETHER_ADDR_LEN] = { 0x02 , 0x00 , 0x00 , 0x00 , 0x00 , 0x01 };
+    u_char slaveAddress[ETHER_ADDR_LEN] = { 0x02 , 0x00 , 0x00 , 0x00 , 0x00 , 0x02 };
+    u_char broadcastAddress[ETHER_ADDR_LEN] = { 0xff , 0xff , 0xff , 0xff , 0xff , 0xff };
+
+    // chiave della sessione registrata
+    encryptionContext replayEncryption;
+    generate_encryptionKey( replayEncryption.key , ENCRYPTION_KEY_LEN );
+    generate_encryptionSalt( replayEncryption.salt );
+
+    // il file generato è sempre lo stesso a parità di parametri ( tranne la chiave )
+    srand( framesCount ^ discPercent );
+
+    // in media un pacchetto su 100/discPercent è dell'applicazione, e quasi tutti sono messaggi
+    if ( discPercent < 1 )
+        discPercent = 1;
+    double frameInterval = ( messageRate > 0 ) ? discPercent * 10000.0 / messageRate : REPLAY_FRAME_INTERVAL;
+
+    u_char packet[TRANSMIT_PACKET_LEN];
+    packetHeader header;
+    memset( &header , 0 , sizeof(header) );
+    int discIndex = 0 , discFrames = 0;
+
+    for ( int f=0 ; f<framesCount ; f++ ) {
+
+        int packetLength = 500;
+
+        if ( f == framesCount-1 ) { // l'ultimo pacchetto chiude la sessione
+            build_replayHeader( packet , slaveAddress , masterAddress , 0x05 );
+            discFrames++;
+        }
+        else if ( rand() % 100 >= discPercent ) { // traffico estraneo
+            packetLength = build_noisePacket( packet );
         }
-        packet[15+i] = name[i];
+        else {
+
+            if ( discIndex == 0 || discIndex % REPLAY_BEACON_INTERVAL == 0 ) { // RTCS di un dispositivo della rete
+                u_char hostAddress[ETHER_ADDR_LEN] = { 0x02 , 0x00 , 0x00 , 0x00 , 0x01 , discIndex / REPLAY_BEACON_INTERVAL % REPLAY_FAKE_HOSTS };
+                build_replayHeader( packet , broadcastAddress , hostAddress , 0x00 );
+                sprintf( (char*) packet+15 , "ReplayDevice%02x" , hostAddress[5] );
+            }
+            else if ( discIndex == 1 ) { // STCS del cMaster
+                build_replayHeader( packet , slaveAddress , masterAddress , 0x01 );
+                strcpy( (char*) packet+15 , "ReplayMaster" );
+            }
+            else if ( discIndex == 2 ) { // chiave di criptazione
+                build_replayHeader( packet , slaveAddress , masterAddress , 0x04 );
+                memcpy( packet+15 , replayEncryption.key , ENCRYPTION_KEY_LEN );
+                memcpy( packet+15+ENCRYPTION_KEY_LEN , replayEncryption.salt , ENCRYPTION_SALT_LEN );
+            }
+            else { // messaggio criptato con la chiave della sessione
+                build_replayHeader( packet , slaveAddress , masterAddress , 0x04 );
+                char message[100];
+                int messageLength = sprintf( message , "Replayed message number %d\n" , discIndex );
+                encrypt_buffer( message , messageLength , replayEncryption.key , replayEncryption.salt );
+                packet[15] = 0; // prima chiave della sessione
+                packet[16] = messageLength >> 8;
+                packet[17] = messageLength & 0xff;
+                memcpy( packet+18 , message , messageLength );
+            }
+
+            discIndex++;
+            discFrames++;
+
+        }
+
+        // scrivo il pacchetto nel file
+        header.caplen = header.len = packetLength;
+        long long frameTime = (long long) ( f * frameInterval );
+        header.ts.tv_sec = frameTime / 1000000;
+        header.ts.tv_usec = frameTime % 1000000;
+        pcap_dump( (u_char*) dumper , &header , packet );
+
     }
 
-    // invio del pacchetto
-    int sendingResult = pcap_sendpacket( nicHandle , packet , 500 );
-    if ( sendingResult == 0 )
-        return;
+    pcap_dump_close( dumper );
+    pcap_close( deadHandle );
 
-    // gestione dell'eventuale errore
-    fprintf( stderr , "\nError sending the packet: %s. Restart the program." , pcap_geterr(nicHandle) );
-    Sleep(10000); // 10 secondi
-    exit(1);
+    printf( "%d frames written to %s (%d DISC frames, %d background frames, one frame every %.2f us).\n" , framesCount , savefilePath , discFrames , framesCount - discFrames , frameInterval );
 
 }
 
-void receive_STCS ( pcap_t *nicHandle ) {
-    //. funzione che attende una STCS
+void print_replayStage ( const char *stageName , LONGLONG stageTicks , unsigned long long stageFrames , LONGLONG frequency ) {
+    //. funzione che stampa il tempo speso in una fase della ricezione
+
+    double stageSeconds = (double) stageTicks / frequency;
+    fprintf( stderr , "%-10s %10.3f ms %10.1f ns/frame (%llu frames)\n" , stageName , stageSeconds * 1000 ,
+             stageFrames > 0 ? stageSeconds * 1e9 / stageFrames : 0 , stageFrames );
+
+}
+
+void replay_savefile ( char *savefilePath , double messageRate ) {
+    //. funzione che fa passare i pacchetti di un file pcap per le stesse funzioni usate in ricezione, il più velocemente possibile ( o al ritmo di messaggi specificato ), e misura ogni fase
+
+    char errorBuffer[PCAP_ERRBUF_SIZE];
+    pcap_t *replayHandle = pcap_open_offline( savefilePath , errorBuffer );
+    if ( replayHandle == NULL ) {
+        fprintf( stderr , "\nError opening the file %s: %s. Restart the program." , savefilePath , errorBuffer );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
+
+    // durante la riproduzione le risposte ( conferme, chiavi ) non vengono inviate
+    replayMode = TRUE;
+    boolean localAddressKnown = FALSE; // il mio indirizzo è il destinatario della prima STCS
+    boolean keyKnown = FALSE;          // il primo pacchetto di tipo 4 dopo la STCS è la chiave
+
+    // contatori e tempi ( in tick del contatore ad alta risoluzione ) di ogni fase
+    unsigned long long frames = 0 , discFrames = 0 , handshakeFrames = 0 , sessionFrames = 0 , messages = 0 , sessions = 0 , bytes = 0;
+    LONGLONG readTicks = 0 , filterTicks = 0 , handshakeTicks = 0 , sessionTicks = 0 , messageTicks = 0;
+    double maxLag = 0 , lastLag = 0; // ritardo dei messaggi rispetto al ritmo richiesto, in secondi
+
+    // i messaggi consegnati passano dall'interfaccia, come durante la chat
+    start_terminal();
 
     int readingResult;
     packetHeader *header;
     const u_char *packetData;
+    LARGE_INTEGER replayStart , stageStart , stageEnd , frequency;
+    QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &replayStart );
+    stageStart = replayStart;
 
-    // variabili per un timer che interrompa l'ascolto dopo un certo tempo
-    int milliseconds = 0 , trigger = 60000; // 60 secondi
-    clock_t start = clock();
+    while ( (readingResult=pcap_next_ex( replayHandle , &header , &packetData )) >= 0 ) {
 
-    while ( ((readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0) && (milliseconds<trigger) ) {
-        if ( readingResult == 0 ) {
-            printf("Timeout expired. Restart the program.\n");
-            exit(0);
-        }
+        //. lettura del pacchetto
+        QueryPerformanceCounter( &stageEnd );
+        readTicks += stageEnd.QuadPart - stageStart.QuadPart;
+        stageStart = stageEnd;
+        frames++;
+        bytes += header->caplen;
 
-        // aggiorno il timer
-        clock_t difference = clock() - start;
-        milliseconds = difference * 1000 / CLOCKS_PER_SEC;
 
 
+        //. filtro: scarto i pacchetti che non sono dell'applicazione
+        boolean discPacket = header->caplen > ETHER_HEAD_LEN && packetData[12] == 0x7a && packetData[13] == 0xbc;
+        boolean forMe = discPacket && localAddressKnown && memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) == 0;
+        boolean fromInterlocutor = forMe && memcmp( packetData+6 , dsapAddress.addressBytes , ETHER_ADDR_LEN ) == 0;
 
-        //. controlli sulla validità del pacchetto
-        // controllo che il pacchetto sia di tipo STCS
-        if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x01 )
-            continue;
+        QueryPerformanceCounter( &stageEnd );
+        filterTicks += stageEnd.QuadPart - stageStart.QuadPart;
+        stageStart = stageEnd;
 
-        // controllo che il pacchetto sia per me
-        if ( memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+        if ( discPacket == FALSE )
             continue;
+        discFrames++;
 
-        // controllo che il pacchetto sia stato inviato dal dispositivo scelto
-        if ( memcmp( packetData+6 , dsapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+
+
+        //. pacchetti di connessione: RTCS, STCS, chiave e chiusura
+        boolean handshakePacket = TRUE;
+        if ( packetData[14] == 0x00 ) {
+            if ( admit_packet( packetData , header , ADMISSION_DISCOVERY ) )
+                add_availableInterlocutor( packetData );
+        }
+        else if ( packetData[14] == 0x01 && ( localAddressKnown == FALSE || forMe ) ) {
+            memcpy( ssapAddress.addressBytes , packetData , ETHER_ADDR_LEN );
+            localAddressKnown = TRUE;
+            accept_STCS( packetData );
+            keyKnown = FALSE;
+            sessions++;
+        }
+        else if ( packetData[14] == 0x04 && fromInterlocutor && keyKnown == FALSE ) {
+            accept_encryptionKey( packetData );
+            keyKnown = TRUE;
+        }
+        else if ( packetData[14] == 0x05 && fromInterlocutor ) {
+            keyKnown = FALSE; // la sessione è chiusa: il programma non viene terminato, così si può misurare anche la sessione successiva
+        }
+        else {
+            handshakePacket = FALSE;
+        }
+
+        if ( handshakePacket ) {
+            QueryPerformanceCounter( &stageEnd );
+            handshakeTicks += stageEnd.QuadPart - stageStart.QuadPart;
+            stageStart = stageEnd;
+            handshakeFrames++;
             continue;
+        }
 
 
 
-        //. operazioni da eseguire se il pacchetto è valido
-        // setto il DSAP al MAC del mittente
-        set_dsapAddress( packetData+ETHER_ADDR_LEN );
+        //. pacchetti della sessione: decriptazione e consegna come in ricezione
+        if ( packetData[14] == 0x04 && fromInterlocutor ) {
+            // con un ritmo richiesto aspetto l'istante in cui il messaggio sarebbe arrivato; l'attesa non conta in nessuna fase
+            if ( messageRate > 0 ) {
+                double dueTime = ( messages+1 ) / messageRate , now;
+                while ( ( now = elapsed_seconds( replayStart ) ) < dueTime ) {
+                    if ( dueTime - now > 0.02 )
+                        Sleep(10);
+                }
+                lastLag = now - dueTime;
+                if ( lastLag > maxLag )
+                    maxLag = lastLag;
+                QueryPerformanceCounter( &stageStart );
+            }
+        }
+        handle_sessionPacket( replayHandle , header , packetData );
+
+        QueryPerformanceCounter( &stageEnd );
+        if ( packetData[14] == 0x04 && fromInterlocutor ) {
+            messageTicks += stageEnd.QuadPart - stageStart.QuadPart;
+            messages++;
+        } else {
+            sessionTicks += stageEnd.QuadPart - stageStart.QuadPart;
+            sessionFrames++;
+        }
+        stageStart = stageEnd;
+
+    }
+
+    // l'ultima lettura ( fine del file ) conta nel tempo di lettura
+    QueryPerformanceCounter( &stageEnd );
+    readTicks += stageEnd.QuadPart - stageStart.QuadPart;
+
+    if ( readingResult == -1 )
+        fprintf( stderr , "\nError reading the file %s: %s." , savefilePath , pcap_geterr(replayHandle) );
+    pcap_close( replayHandle );
+    stop_terminal();
+
+
+
+    //. stampo i risultati ( su stderr, così i messaggi consegnati possono essere rediretti altrove )
+    double totalSeconds = (double) ( stageEnd.QuadPart - replayStart.QuadPart ) / frequency.QuadPart;
+    fprintf( stderr , "\n---\nReplayed %s in %.3f s\n" , savefilePath , totalSeconds );
+    fprintf( stderr , "Frames:   %llu (%llu DISC), %.0f frames/s, %.1f MB/s\n" , frames , discFrames ,
+             totalSeconds > 0 ? frames / totalSeconds : 0 , totalSeconds > 0 ? bytes / totalSeconds / 1e6 : 0 );
+    fprintf( stderr , "Messages: %llu in %llu sessions, %.0f messages/s\n" , messages , sessions ,
+             totalSeconds > 0 ? messages / totalSeconds : 0 );
+    if ( messageRate > 0 )
+        fprintf( stderr , "Paced at %.0f messages/s: delay behind the pace max %.3f ms, at the end %.3f ms\n" , messageRate , maxLag * 1000 , lastLag * 1000 );
+    print_replayStage( "read" , readTicks , frames , frequency.QuadPart );
+    print_replayStage( "filter" , filterTicks , frames , frequency.QuadPart );
+    print_replayStage( "handshake" , handshakeTicks , handshakeFrames , frequency.QuadPart );
+    print_replayStage( "messages" , messageTicks , messages , frequency.QuadPart );
+    print_replayStage( "session" , sessionTicks , sessionFrames , frequency.QuadPart );
+    print_admissionStats( stderr );
+    print_terminalStats( stderr );
+
+}
 
-        // copio il nome del mittente nelle variabili globali
-        myInterlocutor.name = (char*) malloc( sizeof(char) * ( strlen(packetData+15) + 1 ) );
-        strcpy( myInterlocutor.name , packetData+15 );
-        myInterlocutor.address = dsapAddress;
-        SetConsoleTitle( myInterlocutor.name );
 
-        break;
 
-    }
 
-    if ( milliseconds >= trigger ) {
-        printf("No STCS has been received. Restart the program.\n");
-        Sleep(10000); // 10 secondi
-        exit(1);
-    }
 
-}
 
+//! === SIMULATOR SECTION ===
+unsigned long long simulator_random () {
+    //. funzione che genera un numero pseudocasuale ( xorshift64* ): a parità di seme la sequenza è sempre la stessa
 
+    simulator.randomState ^= simulator.randomState >> 12;
+    simulator.randomState ^= simulator.randomState << 25;
+    simulator.randomState ^= simulator.randomState >> 27;
 
+    return simulator.randomState * 0x2545F4914F6CDD1DULL;
 
+}
 
+boolean simulator_chance ( double percent ) {
+    //. funzione che restituisce TRUE con la probabilità specificata
 
-//! === ENCRYPTION KEY SENDING-RECEIVING SECTION ===
-void send_encryptionKey ( pcap_t *nicHandle ) {
-    //. funzione che genera ed invia la chiave di criptazione (+ il sale)
+    return ( simulator_random() >> 11 ) * ( 100.0 / 9007199254740992.0 ) < percent;
 
-    // genero la chiave di criptazione
-    encryptionKey = (char*) malloc( sizeof(char) * ( 33 ) );
-    generate_encryptionKey( encryptionKey , 33 );
+}
 
-    // genero il sale
-    encryptionSalt = (char*) malloc( sizeof(char) * ( 5 ) );
-    generate_encryptionSalt( encryptionSalt );
+void set_simAddress ( u_char *addressBytes , int peerIndex ) {
+    //. funzione che scrive il MAC di un dispositivo simulato ( localmente amministrato, 02:53:49:4d:xx:xx )
 
+    addressBytes[0] = 0x02;
+    addressBytes[1] = 0x53;
+    addressBytes[2] = 0x49;
+    addressBytes[3] = 0x4d;
+    addressBytes[4] = peerIndex >> 8;
+    addressBytes[5] = peerIndex & 0xff;
 
+}
 
-    // invio la chiave di criptazione
-    u_char packet[500];
-    
-    // setto il DSAP al MAC del dispositivo specificato
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i] = dsapAddress.addressBytes[i];
+int read_simAddress ( const u_char *addressBytes ) {
+    //. funzione che restituisce l'indice del dispositivo simulato con il MAC specificato ( -1 se non è simulato )
 
-    // setto il SSAP in modo tale che sia uguale al mio MAC
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i-ETHER_ADDR_LEN];
-    
-    // setto l'ethertype a quello usato per identificare l'applicazione
-    packet[12] = 0x7a;
-    packet[13] = 0xbc;
+    if ( addressBytes[0] != 0x02 || addressBytes[1] != 0x53 || addressBytes[2] != 0x49 || addressBytes[3] != 0x4d )
+        return -1;
 
-    // setto il primo byte a 4 ( per far confondere la chiave di criptazione con un messaggio criptato)
-    packet[14] = 0x04;
+    int peerIndex = addressBytes[4] << 8 | addressBytes[5];
+    return ( peerIndex < simulator.peersCount ) ? peerIndex : -1;
 
-    // copio la chiave di criptazione nel pacchetto
-    for ( int i=0 ; i<32 ; i++ )
-        packet[15+i] = encryptionKey[i];
+}
 
-    // copio il sale nel pacchetto
-    for ( int i=0 ; i<32 ; i++ )
-        packet[47+i] = encryptionSalt[i];
+void load_sessionContext ( const sessionContext *session ) {
+    //. funzione che mette nelle variabili globali lo stato della sessione di un dispositivo simulato, così le funzioni di ricezione lo usano come il proprio
+
+    ssapAddress = session->ssapAddress;
+    dsapAddress = session->dsapAddress;
+    myInterlocutor = session->myInterlocutor;
+    availableInterlocutorsHead = session->availableInterlocutorsHead;
+    availableInterlocutorsPool = session->availableInterlocutorsPool;
+    availableInterlocutorsPoolLen = session->availableInterlocutorsPoolLen;
+    availableInterlocutorsCount = session->availableInterlocutorsCount;
+    currentEncryption = session->currentEncryption;
+    previousEncryption = session->previousEncryption;
+    pendingEncryption = session->pendingEncryption;
+    rekeyPending = session->rekeyPending;
+    rekeyInitiator = session->rekeyInitiator;
+    bytesSinceRekey = session->bytesSinceRekey;
+    lastRekeyClock = session->lastRekeyClock;
 
-    // invio il pacchetto
-    int sendingResult = pcap_sendpacket( nicHandle , packet , 500 );
-    if ( sendingResult == 0 )
-        return;
+}
 
-    // gestione dell'eventuale errore
-    fprintf( stderr , "\nError sending the packet: %s. Restart the program." , pcap_geterr(nicHandle) );
-    Sleep(10000); // 10 secondi
-    exit(1);
+void save_sessionContext ( sessionContext *session ) {
+    //. funzione che salva lo stato della sessione di un dispositivo simulato dopo che le funzioni di ricezione lo hanno modificato
+
+    session->ssapAddress = ssapAddress;
+    session->dsapAddress = dsapAddress;
+    session->myInterlocutor = myInterlocutor;
+    session->availableInterlocutorsHead = availableInterlocutorsHead;
+    session->availableInterlocutorsPool = availableInterlocutorsPool;
+    session->availableInterlocutorsPoolLen = availableInterlocutorsPoolLen;
+    session->availableInterlocutorsCount = availableInterlocutorsCount;
+    session->currentEncryption = currentEncryption;
+    session->previousEncryption = previousEncryption;
+    session->pendingEncryption = pendingEncryption;
+    session->rekeyPending = rekeyPending;
+    session->rekeyInitiator = rekeyInitiator;
+    session->bytesSinceRekey = bytesSinceRekey;
+    session->lastRekeyClock = lastRekeyClock;
 
 }
 
-void receive_encryptionKey ( pcap_t *nicHandle ) {
-    //. funzione che attende la chiave di criptazione (+ il sale) e la salva nelle apposite variabili globali
 
-    int readingResult;
-    packetHeader *header;
-    const u_char *packetData;
 
-    // variabili per un timer che interrompa l'ascolto dopo un certo tempo
-    int milliseconds = 0 , trigger = 10000; // 10 secondi
-    clock_t start = clock();
+void push_simEvent ( simEvent *event ) {
+    //. funzione che inserisce un evento nello heap
 
-    while ( ((readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0) && (milliseconds<trigger) ) {
-        if ( readingResult == 0 )
-            printf("Timeout expired. Restart the program.\n");
+    if ( simulator.eventsCount == simulator.eventsCapacity ) {
+        simulator.eventsCapacity = ( simulator.eventsCapacity == 0 ) ? 1024 : simulator.eventsCapacity * 2;
+        simulator.events = (simEvent*) realloc( simulator.events , simulator.eventsCapacity * sizeof(simEvent) );
+        if ( simulator.events == NULL ) {
+            fprintf( stderr , "\nError allocating the simulator events. Restart the program." );
+            Sleep(10000); // 10 secondi
             exit(1);
         }
+    }
 
-        // aggiorno il timer
-        clock_t difference = clock() - start;
-        milliseconds = difference * 1000 / CLOCKS_PER_SEC;
+    event->sequence = simulator.sequence++;
 
+    // faccio risalire l'evento finché il padre non viene prima
+    int position = simulator.eventsCount++;
+    while ( position > 0 ) {
+        int parent = ( position - 1 ) / 2;
+        simEvent *parentEvent = &simulator.events[parent];
+        if ( parentEvent->time < event->time || ( parentEvent->time == event->time && parentEvent->sequence < event->sequence ) )
+            break;
+        simulator.events[position] = *parentEvent;
+        position = parent;
+    }
+    simulator.events[position] = *event;
 
+}
 
-        //. controlli sulla validità del pacchetto
-        // controllo che il pacchetto sia di tipo messaggio
-        if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x04 )
-            continue;
+void pop_simEvent ( simEvent *event ) {
+    //. funzione che estrae dallo heap l'evento che viene prima
 
-        // controllo che il pacchetto sia per me
-        if ( memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
-            continue;
+    *event = simulator.events[0];
+    simEvent last = simulator.events[--simulator.eventsCount];
 
-        // controllo che il pacchetto sia stato inviato dal dispositivo scelto
-        if ( memcmp( packetData+6 , dsapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
-            continue;
+    // faccio scendere l'ultimo evento finché i figli non vengono dopo
+    int position = 0;
+    while (1) {
+        int child = 2 * position + 1;
+        if ( child >= simulator.eventsCount )
+            break;
+        if ( child+1 < simulator.eventsCount && ( simulator.events[child+1].time < simulator.events[child].time ||
+             ( simulator.events[child+1].time == simulator.events[child].time && simulator.events[child+1].sequence < simulator.events[child].sequence ) ) )
+            child++;
+        if ( last.time < simulator.events[child].time || ( last.time == simulator.events[child].time && last.sequence < simulator.events[child].sequence ) )
+            break;
+        simulator.events[position] = simulator.events[child];
+        position = child;
+    }
+    simulator.events[position] = last;
 
+}
 
+void schedule_simTimer ( int peerIndex , unsigned long long delay ) {
+    //. funzione che programma il prossimo timer di un dispositivo ( annullando quello precedente )
 
-        //. operazioni da eseguire se il pacchetto è valido
-        // copio la chiave di criptazione nelle variabili globali
-        encryptionKey = (char*) malloc( sizeof(char) * ( 33 ) );
-        for ( int i=0 ; i<32 ; i++ )
-            encryptionKey[i] = packetData[15+i];
+    simEvent event;
+    event.time = simulator.now + delay;
+    event.peerIndex = peerIndex;
+    event.timerGeneration = ++simulator.peers[peerIndex].timerGeneration;
+    event.frameLength = 0;
+    push_simEvent( &event );
 
-        // copio il sale nelle variabili globali
-        encryptionSalt = (char*) malloc( sizeof(char) * ( 5 ) );
-        for ( int i=0 ; i<4 ; i++ )
-            encryptionSalt[i] = packetData[47+i];
+}
 
-        break;
 
+
+void transmit_simFrame ( int destinationIndex , const u_char *frame , int frameLength ) {
+    //. funzione che mette un pacchetto sul segmento virtuale: banda condivisa, latenza, perdita, duplicazione e riordinamento
+
+    simulator.framesSent++;
+
+    // il pacchetto occupa il segmento per il tempo di trasmissione, dopo quelli già in coda
+    unsigned long long transmitStart = ( simulator.busyUntil > simulator.now ) ? simulator.busyUntil : simulator.now;
+    int wireLength = ( frameLength < SIM_MIN_WIRE_LEN ) ? SIM_MIN_WIRE_LEN : frameLength;
+    simulator.busyUntil = transmitStart + (unsigned long long) ( wireLength * 8 / simulator.bitsPerMicrosecond );
+
+    // i pacchetti broadcast vengono persi ( o no ) per ogni destinatario al momento della consegna
+    if ( destinationIndex >= 0 && simulator_chance( simulator.lossPercent ) ) {
+        simulator.framesLost++;
+        return;
     }
 
-    if ( milliseconds >= trigger ) {
-        printf("No encryption key has been received. Restart the program.\n");
-        Sleep(10000); // 10 secondi
-        exit(1);
+    simEvent event;
+    event.peerIndex = destinationIndex;
+    event.frameLength = frameLength;
+    memcpy( event.frame , frame , frameLength );
+
+    int copies = simulator_chance( simulator.duplicatePercent ) ? 2 : 1;
+    simulator.framesDuplicated += copies - 1;
+    for ( int c=0 ; c<copies ; c++ ) {
+        // senza ritardo aggiuntivo i pacchetti arrivano nell'ordine in cui sono stati trasmessi, come su un segmento reale
+        event.time = simulator.busyUntil + simulator.latency;
+        if ( simulator.reorderDelay > 0 && simulator_chance( simulator.reorderPercent ) )
+            event.time += 1 + simulator_random() % simulator.reorderDelay;
+        push_simEvent( &event );
     }
 
-}   
+}
 
+int build_simFrame ( u_char *frame , int destinationIndex , int sourceIndex , u_char packetType ) {
+    //. funzione che scrive l'header di un pacchetto simulato ( uguale a quello reale ) e restituisce la lunghezza dell'header
 
+    memset( frame , 0 , SIM_FRAME_LEN );
 
+    // setto il DSAP ( broadcast per le RTCS ) ed il SSAP
+    if ( destinationIndex < 0 )
+        memset( frame , 0xff , ETHER_ADDR_LEN );
+    else
+        set_simAddress( frame , destinationIndex );
+    set_simAddress( frame+ETHER_ADDR_LEN , sourceIndex );
 
+    // setto l'ethertype a quello usato per identificare l'applicazione
+    frame[12] = 0x7a;
+    frame[13] = 0xbc;
 
+    // setto il tipo del pacchetto
+    frame[14] = packetType;
 
-//! === CHAT SECTION ===
-void send_message ( pcap_t *nicHandle , char *message ) {
-    //. funzione che invia un messaggio dopo averlo criptato
+    return 15;
 
-    u_char packet[500];
+}
 
-    // setto il DSAP al MAC del dispositivo specificato
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i] = dsapAddress.addressBytes[i];
+void send_simControl ( int peerIndex , int destinationIndex , u_char packetType ) {
+    //. funzione che invia un pacchetto di connessione simulato ( RTCS, STCS, chiave o chiusura )
 
-    // setto il SSAP in modo tale che sia uguale al mio MAC
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i-ETHER_ADDR_LEN];
+    simPeer *peer = &simulator.peers[peerIndex];
+    u_char frame[SIM_FRAME_LEN];
+    int frameLength = build_simFrame( frame , destinationIndex , peerIndex , packetType );
 
-    // setto l'ethertype a quello usato per identificare l'applicazione
-    packet[12] = 0x7a;
-    packet[13] = 0xbc;
+    if ( packetType == 0x00 || packetType == 0x01 ) { // RTCS e STCS contengono il nome
+        frameLength += sprintf( (char*) frame+15 , "SimPeer%05d" , peerIndex ) + 1;
+    }
+    else if ( packetType == 0x04 ) { // chiave e sale
+        memcpy( frame+15 , peer->session.currentEncryption.key , ENCRYPTION_KEY_LEN );
+        memcpy( frame+15+ENCRYPTION_KEY_LEN , peer->session.currentEncryption.salt , ENCRYPTION_SALT_LEN );
+        frameLength += ENCRYPTION_KEY_LEN + ENCRYPTION_SALT_LEN;
+    }
 
-    // setto il primo byte a 4 ( per far riconoscere il messaggio )
-    packet[14] = 0x04;
+    transmit_simFrame( destinationIndex , frame , frameLength );
 
-    // cripto il messaggio
-    encrypt_string( message , encryptionKey , encryptionSalt );
+}
 
-    // copio il messaggio nel pacchetto
-    for ( int i=0 ; i<strlen(message) ; i++ )
-        packet[15+i] = message[i];
+void send_simMessage ( int peerIndex ) {
+    //. funzione che invia un messaggio simulato, criptato con la chiave della sessione come quelli reali
 
-    // invio il pacchetto
-    int sendingResult = pcap_sendpacket( nicHandle , packet , 500 );
-    if ( sendingResult == 0 )
-        return;
+    simPeer *peer = &simulator.peers[peerIndex];
+    u_char frame[SIM_FRAME_LEN];
+    build_simFrame( frame , peer->partner , peerIndex , 0x04 );
 
-    // gestione dell'eventuale errore
-    fprintf( stderr , "\nError sending the packet: %s. Restart the program." , pcap_geterr(nicHandle) );
-    Sleep(10000); // 10 secondi
-    exit(1);
+    char message[SIM_FRAME_LEN];
+    int messageLength = sprintf( message , "sim %u\n" , peer->messageCounter++ );
+    encryptionContext *messageEncryption = &peer->session.currentEncryption;
+    encrypt_buffer( message , messageLength , messageEncryption->key , messageEncryption->salt );
+
+    frame[15] = messageEncryption->epoch;
+    frame[16] = messageLength >> 8;
+    frame[17] = messageLength & 0xff;
+    memcpy( frame+18 , message , messageLength );
+
+    simulator.messagesSent++;
+    transmit_simFrame( peer->partner , frame , 18 + messageLength );
 
 }
 
-void receiveAndPrint_message ( pcap_t *nicHandle ) {
-    //. funzione che attende un messaggio e lo stampa dopo averlo decriptato
 
-    int readingResult;
-    packetHeader *header;
-    const u_char *packetData;
 
-    while ( (readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0 ) {
-        if ( readingResult == 0 )
-            continue;
+void start_simBeaconing ( int peerIndex ) {
+    //. funzione che rende un cSlave di nuovo disponibile: ripete la RTCS finché un cMaster non lo sceglie
 
+    simPeer *peer = &simulator.peers[peerIndex];
+    peer->state = SIM_BEACONING;
+    peer->partner = -1;
+    peer->stateSince = simulator.now;
+    schedule_simTimer( peerIndex , simulator_random() % SIM_BEACON_INTERVAL );
 
-            
-        //. controlli sulla validità del pacchetto
-        // controllo che il pacchetto sia di tipo messaggio
-        if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x04 )
-            continue;
+}
 
-        // controllo che il pacchetto sia per me
-        if ( memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
-            continue;
+void start_simDiscovering ( int peerIndex ) {
+    //. funzione che fa tornare un cMaster a cercare un cSlave
 
-        // controllo che il pacchetto sia stato inviato dal dispositivo scelto
-        if ( memcmp( packetData+6 , dsapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
-            continue;
+    simPeer *peer = &simulator.peers[peerIndex];
+    peer->state = SIM_DISCOVERING;
+    peer->partner = -1;
 
+    // la lista dei cSlave sentiti riparte vuota
+    peer->session.availableInterlocutorsHead = NULL;
+    peer->session.availableInterlocutorsCount = 0;
+    peer->stateSince = peer->discoveryStart = simulator.now;
 
+    // solo i cMaster in ricerca ascoltano le RTCS
+    peer->discoveringSlot = simulator.discoveringCount;
+    simulator.discovering[simulator.discoveringCount++] = peerIndex;
 
-        //. operazioni da eseguire se il pacchetto è valido
-        // decripto il messaggio
-        char *decryptedMessage = (char*) malloc( sizeof(char) * ( strlen(packetData+15) + 1 ) );
-        strcpy( decryptedMessage , packetData+15 );
-        decrypt_string( decryptedMessage , encryptionKey , encryptionSalt );
+    schedule_simTimer( peerIndex , SIM_DISCOVERY_WINDOW );
 
-        // stampo il messaggio
-        printf( "%s : %s\n" , myInterlocutor.name , decryptedMessage );
+}
 
-        break;
+void stop_simDiscovering ( int peerIndex ) {
+    //. funzione che toglie un cMaster dalla lista di quelli in ricerca
 
-    }
+    simPeer *peer = &simulator.peers[peerIndex];
+    int lastIndex = simulator.discovering[--simulator.discoveringCount];
+    simulator.discovering[peer->discoveringSlot] = lastIndex;
+    simulator.peers[lastIndex].discoveringSlot = peer->discoveringSlot;
+    peer->discoveringSlot = -1;
 
 }
 
+void connect_simPeer ( int peerIndex ) {
+    //. funzione che fa scegliere ad un cMaster uno dei cSlave sentiti e gli invia STCS e chiave
+
+    simPeer *peer = &simulator.peers[peerIndex];
+    stop_simDiscovering( peerIndex );
+
+    // scelgo a caso uno dei cSlave nella lista ( come farebbe l'utente ) e lo salvo come interlocutore
+    sessionContext *session = &peer->session;
+    availableInterlocutorsList *candidate = session->availableInterlocutorsHead;
+    for ( int skip = simulator_random() % session->availableInterlocutorsCount ; skip > 0 ; skip-- )
+        candidate = candidate->next;
+    session->myInterlocutor = candidate->interlocutor;
+    session->dsapAddress = candidate->interlocutor.address;
+    peer->partner = read_simAddress( session->dsapAddress.addressBytes );
+
+    // genero la chiave della sessione con il generatore della simulazione ( così la simulazione resta ripetibile )
+    encryptionContext *sessionEncryption = &session->currentEncryption;
+    for ( int i=0 ; i<ENCRYPTION_KEY_LEN ; i++ )
+        sessionEncryption->key[i] = 'A' + simulator_random() % 26;
+    sessionEncryption->key[ENCRYPTION_KEY_LEN] = '\0';
+    for ( int i=0 ; i<ENCRYPTION_SALT_LEN ; i++ )
+        sessionEncryption->salt[i] = 'A' + simulator_random() % 26;
+    sessionEncryption->salt[ENCRYPTION_SALT_LEN] = '\0';
+    sessionEncryption->epoch = 0;
+    session->previousEncryption = *sessionEncryption;
+    session->rekeyPending = FALSE;
+    session->bytesSinceRekey = 0;
+
+    send_simControl( peerIndex , peer->partner , 0x01 ); // STCS
+    send_simControl( peerIndex , peer->partner , 0x04 ); // chiave
+
+    peer->state = SIM_CONNECTING;
+    peer->stateSince = peer->lastHeard = simulator.now;
+    schedule_simTimer( peerIndex , simulator_random() % SIM_MESSAGE_INTERVAL );
 
+}
 
+void handle_simTimer ( int peerIndex ) {
+    //. funzione che esegue l'azione periodica di un dispositivo in base al suo stato
 
+    simPeer *peer = &simulator.peers[peerIndex];
+    unsigned long long messageDelay = SIM_MESSAGE_INTERVAL / 2 + simulator_random() % SIM_MESSAGE_INTERVAL;
 
+    switch ( peer->state ) {
 
-//! === CONNECTION MAINTENANCE SECTION ===
-void send_closeConnectionPacket ( pcap_t *nicHandle ) {
-    //. funzione che invia un pacchetto che comunica la chiusura della connessione
-
-    u_char packet[500];
+        case SIM_BEACONING:
+            send_simControl( peerIndex , -1 , 0x00 ); // RTCS
+            schedule_simTimer( peerIndex , SIM_BEACON_INTERVAL );
+            break;
 
-    // setto il DSAP al MAC del dispositivo specificato
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i] = dsapAddress.addressBytes[i];
+        case SIM_WAITING_KEY: // la chiave non è arrivata
+            simulator.peersLost++;
+            start_simBeaconing( peerIndex );
+            break;
 
-    // setto il SSAP in modo tale che sia uguale al mio MAC
-    for ( int i=0 ; i<ETHER_ADDR_LEN ; i++ )
-        packet[i+ETHER_ADDR_LEN] = ssapAddress.addressBytes[i-ETHER_ADDR_LEN];
+        case SIM_DISCOVERING:
+            if ( peer->session.availableInterlocutorsHead != NULL )
+                connect_simPeer( peerIndex );
+            else
+                schedule_simTimer( peerIndex , SIM_DISCOVERY_WINDOW );
+            break;
 
-    // setto l'ethertype a quello usato per identificare l'applicazione
-    packet[12] = 0x7a;
-    packet[13] = 0xbc;
+        case SIM_CONNECTING:
+        case SIM_CHATTING:
+
+            // l'interlocutore non risponde: se non ha mai risposto un altro cMaster lo ha scelto prima di me
+            if ( simulator.now - peer->lastHeard > SIM_SESSION_TIMEOUT ) {
+                if ( peer->state == SIM_CONNECTING )
+                    simulator.collisions++;
+                else
+                    simulator.peersLost++;
+                if ( peer->isMaster )
+                    start_simDiscovering( peerIndex );
+                else
+                    start_simBeaconing( peerIndex );
+                break;
+            }
 
-    // setto il primo byte a 5 ( per far riconoscere il pacchetto )
-    packet[14] = 0x05;
+            // il cMaster chiude la sessione dopo un certo tempo
+            if ( peer->isMaster && peer->state == SIM_CHATTING && simulator.now - peer->stateSince > SIM_SESSION_LENGTH ) {
+                send_simControl( peerIndex , peer->partner , 0x05 );
+                simulator.sessionsClosed++;
+                start_simDiscovering( peerIndex );
+                break;
+            }
 
-    // invio il pacchetto
-    int sendingResult = pcap_sendpacket( nicHandle , packet , 500 );
-    if ( sendingResult == 0 )
-        return;
+            send_simMessage( peerIndex );
+            schedule_simTimer( peerIndex , messageDelay );
+            break;
 
-    // gestione dell'eventuale errore
-    exit(1);
+    }
 
 }
 
-void listen_closeConnectionPacket ( pcap_t *nicHandle ) {
-    //. funzione che ascolta un pacchetto che comunica la chiusura della connessione
+void deliver_simFrame ( int peerIndex , const u_char *frame , int frameLength ) {
+    //. funzione che consegna un pacchetto ad un dispositivo simulato attraverso le stesse funzioni della ricezione reale
 
-    int readingResult;
-    packetHeader *header;
-    const u_char *packetData;
+    simPeer *peer = &simulator.peers[peerIndex];
 
-    while ( (readingResult=pcap_next_ex( nicHandle , &header , &packetData )) >= 0 ) {
-        if ( readingResult == 0 )
-            continue;
+    //. controlli sulla validità del pacchetto
+    // controllo che il pacchetto sia dell'applicazione
+    if ( frame[12] != 0x7a || frame[13] != 0xbc )
+        return;
 
+    // controllo che il pacchetto sia per me ( o broadcast, per le RTCS )
+    if ( frame[14] != 0x00 && memcmp( frame , peer->session.ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
+        return;
 
+    int sourceIndex = read_simAddress( frame+ETHER_ADDR_LEN );
+    if ( sourceIndex < 0 )
+        return;
+    simulator.framesDelivered++;
 
-        //. controlli sulla validità del pacchetto
-        // controllo che il pacchetto sia di tipo closeConnection
-        if ( packetData[12] != 0x7a || packetData[13] != 0xbc || packetData[14] != 0x05 )
-            continue;
+    // ricostruisco il pacchetto intero ( lungo 500 byte come quelli reali ) e l'header con l'istante virtuale
+    u_char packetData[500];
+    memset( packetData , 0 , 500 );
+    memcpy( packetData , frame , frameLength );
+    packetHeader header;
+    header.ts.tv_sec = (long) ( simulator.now / 1000000 );
+    header.ts.tv_usec = (long) ( simulator.now % 1000000 );
+    header.caplen = header.len = 500;
 
-        // controllo che il pacchetto sia per me
-        if ( memcmp( packetData , ssapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
-            continue;
 
-        // controllo che il pacchetto sia stato inviato dal dispositivo scelto
-        if ( memcmp( packetData+6 , dsapAddress.addressBytes , ETHER_ADDR_LEN ) != 0 )
-            continue;
 
+    //. operazioni da eseguire in base al tipo di pacchetto ed allo stato ( la sessione del dispositivo è nelle variabili globali )
+    load_sessionContext( &peer->session );
 
+    if ( frame[14] == 0x00 ) { // RTCS: il cMaster in ricerca aggiunge il cSlave alla lista dei dispositivi disponibili
+        if ( peer->state == SIM_DISCOVERING )
+            add_availableInterlocutor( packetData );
+    }
+    else if ( frame[14] == 0x01 ) { // STCS: il cSlave accetta solo se è libero
+        if ( peer->state == SIM_BEACONING ) {
+            accept_STCS( packetData );
+            peer->state = SIM_WAITING_KEY;
+            peer->partner = sourceIndex;
+            peer->stateSince = peer->lastHeard = simulator.now;
+            schedule_simTimer( peerIndex , SIM_SESSION_TIMEOUT );
+        }
+    }
+    else if ( sourceIndex == peer->partner ) { // gli altri pacchetti devono arrivare dall'interlocutore
+        peer->lastHeard = simulator.now;
 
-        //. operazioni da eseguire se il pacchetto è valido
-        printf("\r\n---\nThe connection has been closed by the other device.\n---\n");
-        Sleep(10000); // 10 secondi
-        exit(0);
+        // la chiusura viene gestita qui: end_session termina il programma
+        if ( frame[14] == 0x05 ) {
+            start_simBeaconing( peerIndex );
+        }
+        else if ( frame[14] == 0x04 && peer->state == SIM_WAITING_KEY ) { // il primo pacchetto di tipo 4 è la chiave
+            accept_encryptionKey( packetData );
+            peer->state = SIM_CHATTING;
+            peer->stateSince = simulator.now;
+            schedule_simTimer( peerIndex , simulator_random() % SIM_MESSAGE_INTERVAL );
+        }
+        else {
+            // il primo messaggio del cSlave conferma la sessione al cMaster
+            if ( frame[14] == 0x04 && peer->state == SIM_CONNECTING ) {
+                unsigned long long handshakeTime = simulator.now - peer->discoveryStart;
+                simulator.sessionsEstablished++;
+                simulator.handshakeTotal += handshakeTime;
+                if ( handshakeTime > simulator.handshakeMax )
+                    simulator.handshakeMax = handshakeTime;
+                peer->state = SIM_CHATTING;
+                peer->stateSince = simulator.now;
+            }
 
+            // un messaggio che non arriva a check_simMessage non è stato decriptato ( chiave sconosciuta o lunghezza non valida )
+            unsigned long long messagesChecked = simulator.messagesDelivered + simulator.decryptionFailures;
+            handle_sessionPacket( NULL , &header , packetData );
+            if ( frame[14] == 0x04 && simulator.messagesDelivered + simulator.decryptionFailures == messagesChecked )
+                simulator.decryptionFailures++;
+        }
     }
 
+    save_sessionContext( &peer->session );
+
 }
 
 
 
+void run_simulation ( int peersCount , double seconds , unsigned long long seed , double lossPercent , double duplicatePercent ,
+                      double reorderPercent , unsigned long long latency , unsigned long long reorderDelay , double megabitsPerSecond ) {
+    //. funzione che simula molti dispositivi sullo stesso segmento virtuale, metà cMaster e metà cSlave, per il tempo virtuale specificato
 
+    if ( peersCount < 2 || peersCount > SIM_MAX_PEERS ) {
+        fprintf( stderr , "\nError: the simulated devices must be between 2 and %d." , SIM_MAX_PEERS );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
 
+    memset( &simulator , 0 , sizeof(simulator) );
+    simulator.randomState = seed ? seed : 1; // xorshift non può partire da 0
+    simulator.lossPercent = lossPercent;
+    simulator.duplicatePercent = duplicatePercent;
+    simulator.reorderPercent = reorderPercent;
+    simulator.latency = latency;
+    simulator.reorderDelay = reorderDelay;
+    simulator.bitsPerMicrosecond = megabitsPerSecond;
+    simulator.peersCount = peersCount;
+    simulator.peers = (simPeer*) calloc( peersCount , sizeof(simPeer) );
+    simulator.discovering = (int*) malloc( peersCount * sizeof(int) );
+    if ( simulator.peers == NULL || simulator.discovering == NULL ) {
+        fprintf( stderr , "\nError allocating the simulated devices. Restart the program." );
+        Sleep(10000); // 10 secondi
+        exit(1);
+    }
 
-//! === MASTER & SLAVE CONNECTION ESTABLISHMENT ROUTINES ===
-void cMaster_establish_connection ( pcap_t *nicHandle ) {
-    //. funzione che stabilisce la connessione tra il cMaster ed il cSlave
+    // i dispositivi dispari sono cMaster, quelli pari cSlave
+    for ( int i=0 ; i<peersCount ; i++ ) {
+        simulator.peers[i].isMaster = ( i % 2 == 1 );
+        simulator.peers[i].discoveringSlot = -1;
+        set_simAddress( simulator.peers[i].session.ssapAddress.addressBytes , i );
+        simulator.peers[i].session.availableInterlocutorsPool = simulator.peers[i].candidatesPool;
+        simulator.peers[i].session.availableInterlocutorsPoolLen = SIM_CANDIDATES;
+        if ( simulator.peers[i].isMaster )
+            start_simDiscovering( i );
+        else
+            start_simBeaconing( i );
+    }
 
-    // handshake per stabilire la connessione
-    myInterlocutor = choose_availableInterlocutor(); // scelta dell'interlocutore
-    send_STCS( nicHandle ); // invio la StCS
-    
-    send_encryptionKey( nicHandle ); // invio la chiave di criptazione
+    LARGE_INTEGER wallStart;
+    QueryPerformanceCounter( &wallStart );
+    unsigned long long endTime = (unsigned long long) ( seconds * 1000000 );
 
-}
 
-void cSlave_establish_connection ( pcap_t *nicHandle ) {
-    //. funzione che stabilisce la connessione tra il cSlave ed il cMaster
 
-    // handshake per stabilire la connessione
-    broadcast_RTCS( nicHandle ); // broadcast della RTCS
-    receive_STCS( nicHandle ); // attesa della STCS
+    //. esecuzione degli eventi in ordine di tempo virtuale
+    simEvent event;
+    while ( simulator.eventsCount > 0 && simulator.events[0].time <= endTime ) {
 
-    receive_encryptionKey( nicHandle ); // attesa della chiave di criptazione
+        pop_simEvent( &event );
+        simulator.now = event.time;
+        simulator.eventsProcessed++;
 
-}
+        // timer: viene eseguito solo se non è stato sostituito da uno più recente
+        if ( event.frameLength == 0 ) {
+            if ( event.timerGeneration == simulator.peers[event.peerIndex].timerGeneration )
+                handle_simTimer( event.peerIndex );
+            continue;
+        }
 
-DWORD WINAPI checkout_connection ( void *data ) {
-    //. funzione che controlla periodicamente se l'interlocutore ha inviato un closeConnectionPacket
+        // pacchetto unicast
+        if ( event.peerIndex >= 0 ) {
+            deliver_simFrame( event.peerIndex , event.frame , event.frameLength );
+            continue;
+        }
 
-    pcap_t *nicHandle = (pcap_t*) data;
+        // pacchetto broadcast: viene consegnato ( o perso ) per ogni cMaster in ricerca
+        for ( int i=0 ; i<simulator.discoveringCount ; i++ ) {
+            if ( simulator_chance( simulator.lossPercent ) ) {
+                simulator.framesLost++;
+                continue;
+            }
+            deliver_simFrame( simulator.discovering[i] , event.frame , event.frameLength );
+        }
 
-    while (1) {
-        listen_closeConnectionPacket( nicHandle );
-        Sleep(5000); // 5 secondi
     }
 
+    double wallSeconds = elapsed_seconds( wallStart );
+
+
+
+    //. stampo i risultati
+    printf( "---\nSimulated %d devices for %.1f virtual seconds in %.3f wall seconds (%.0fx), seed %llu\n" ,
+            peersCount , seconds , wallSeconds , wallSeconds > 0 ? seconds / wallSeconds : 0 , seed );
+    printf( "Segment:  loss %.2f%%, duplication %.2f%%, reordering %.2f%% (up to %llu us), latency %llu us, %.1f Mbit/s\n" ,
+            lossPercent , duplicatePercent , reorderPercent , reorderDelay , latency , megabitsPerSecond );
+    printf( "Events:   %llu (%.0f events/s)\n" , simulator.eventsProcessed , wallSeconds > 0 ? simulator.eventsProcessed / wallSeconds : 0 );
+    printf( "Frames:   %llu sent, %llu delivered, %llu lost, %llu duplicated\n" ,
+            simulator.framesSent , simulator.framesDelivered , simulator.framesLost , simulator.framesDuplicated );
+    printf( "Sessions: %llu established, %llu closed, %llu collisions, %llu peers lost, handshake avg %.3f s max %.3f s\n" ,
+            simulator.sessionsEstablished , simulator.sessionsClosed , simulator.collisions , simulator.peersLost ,
+            simulator.sessionsEstablished > 0 ? simulator.handshakeTotal / 1e6 / simulator.sessionsEstablished : 0 , simulator.handshakeMax / 1e6 );
+    printf( "Messages: %llu sent, %llu delivered, %llu not decrypted\n" ,
+            simulator.messagesSent , simulator.messagesDelivered , simulator.decryptionFailures );
+
+    // le variabili globali non devono più puntare al pool di un dispositivo simulato
+    availableInterlocutorsHead = NULL;
+    availableInterlocutorsPool = availableInterlocutorsStorage;
+    availableInterlocutorsPoolLen = PEER_POOL_LEN;
+    availableInterlocutorsCount = 0;
+
+    free( simulator.peers );
+    free( simulator.discovering );
+    free( simulator.events );
+
 }
 
 
@@ -877,14 +6730,85 @@ DWORD WINAPI checkout_connection ( void *data ) {
 
 
 //! === MAIN SECTION ===
-void main () {
+void main ( int argc , char *argv[] ) {
 
-    atexit( send_closeConnectionPacket ); // invio un pacchetto che comunica la chiusura della connessione quando l'applicazione viene chiusa
+    atexit( close_connection ); // invio un pacchetto che comunica la chiusura della connessione quando l'applicazione viene chiusa
 
     //. inizializzazione delle "impostazioni di partenza" comuni a cMaster e cSlave
     SetConsoleTitle("DISC");
+    InitializeCriticalSection( &receptionLock );
+    InitializeCriticalSection( &encryptionLock );
+    InitializeCriticalSection( &groupLock );
+    InitializeCriticalSection( &admissionLock );
+    InitializeCriticalSection( &keepaliveLock );
+    InitializeCriticalSection( &terminalLock );
+    InitializeCriticalSection( &terminalDrawLock );
+    fileAcknowledgementEvent = CreateEvent( NULL , FALSE , FALSE , NULL );
+    start_transmitScheduler(); // thread che invia i pacchetti in ordine di priorità
+
+    //. modalità daemon: nessuna domanda sulla console, i comandi arrivano da un socket Unix
+    if ( argc >= 2 && strcmp( argv[1] , "--daemon" ) == 0 ) {
+        run_daemon( argc-2 , argv+2 );
+        exit(0);
+    }
+    if ( argc >= 3 && strcmp( argv[1] , "--daemon-bench" ) == 0 ) {
+        benchmark_daemon( argv[2] , ( argc >= 4 ) ? atoi(argv[3]) : 100000 , ( argc >= 5 ) ? atoi(argv[4]) : 64 , ( argc >= 6 ) ? argv[5] : NULL );
+        exit(0);
+    }
+
+    //. modalità di misura del gruppo: confronto tra multicast ed un invio per membro
+    if ( argc >= 3 && strcmp( argv[1] , "--group-bench" ) == 0 ) {
+        benchmark_group( argv[2] , ( argc >= 4 ) ? atoi(argv[3]) : 10000 );
+        exit(0);
+    }
+
+    //. modalità relay: collega due segmenti di rete senza partecipare alle conversazioni
+    if ( argc >= 4 && strcmp( argv[1] , "--relay" ) == 0 ) {
+        run_relay( argv[2] , argv[3] );
+        exit(0);
+    }
+
+    //. modalità senza rete, per misurare il percorso di ricezione: generazione e riproduzione di file pcap
+    if ( argc >= 3 && strcmp( argv[1] , "--generate" ) == 0 ) {
+        replayMode = TRUE;
+        generate_savefile( argv[2] , ( argc >= 4 ) ? atoi(argv[3]) : 1000000 , ( argc >= 5 ) ? atoi(argv[4]) : 10 , ( argc >= 6 ) ? atof(argv[5]) : 0 );
+        exit(0);
+    }
+    if ( argc >= 3 && strcmp( argv[1] , "--replay" ) == 0 ) {
+        replay_savefile( argv[2] , ( argc >= 4 ) ? atof(argv[3]) : 0 );
+        exit(0);
+    }
+
+    //. simulazione di molti dispositivi su un segmento virtuale
+    if ( argc >= 2 && strcmp( argv[1] , "--simulate" ) == 0 ) {
+        replayMode = TRUE;
+        simulationMode = TRUE;
+        run_simulation( ( argc >= 3 ) ? atoi(argv[2]) : 5000 ,              // dispositivi
+                        ( argc >= 4 ) ? atof(argv[3]) : 300 ,               // secondi virtuali
+                        ( argc >= 5 ) ? _strtoui64( argv[4] , NULL , 10 ) : 1 , // seme
+                        ( argc >= 6 ) ? atof(argv[5]) : 0 ,                 // perdita in %
+                        ( argc >= 7 ) ? atof(argv[6]) : 0 ,                 // duplicazione in %
+                        ( argc >= 8 ) ? atof(argv[7]) : 0 ,                 // riordinamento in %
+                        ( argc >= 9 ) ? atoi(argv[8]) : 200 ,               // latenza in microsecondi
+                        ( argc >= 10 ) ? atoi(argv[9]) : 1000 ,             // ritardo dei pacchetti riordinati in microsecondi
+                        ( argc >= 11 ) ? atof(argv[10]) : 1000 );           // banda in Mbit/s
+        exit(0);
+    }
+
     pcap_t *nicHandle = choose_NIC(); // scelta della NIC
 
+    // chiedo se vuole una conversazione di gruppo
+    char groupAnswer[10];
+    printf("Do you want to start a group conversation? (y/n) ");
+    fgets( groupAnswer , 10 , stdin );
+    if ( groupAnswer[0] == 'y' || groupAnswer[0] == 'Y' )
+        group_chat( nicHandle );
+
+    // chiedo su quali altre NIC distribuire i trasferimenti di file
+    char stripeNicNames[1000];
+    printf("Other NICs to stripe file transfers over (separated by spaces, empty for none): ");
+    fgets( stripeNicNames , 1000 , stdin );
+
     // chiedo se vuole essere cMaster o cSlave
     boolean isMaster = FALSE;
     char answer[2];
@@ -897,48 +6821,40 @@ void main () {
 
 
     //. esecuzione delle routine di connessione
+    rekeyInitiator = isMaster;
     if ( isMaster )
         cMaster_establish_connection( nicHandle );
     else
         cSlave_establish_connection( nicHandle );
 
-    //. faccio partire un thread che ascolta periodicamente se l'intelocutore ha inviato un closeConnectionPacket
+    //. abbino le NIC aggiuntive a quelle dell'interlocutore
+    open_stripeLinks( nicHandle , stripeNicNames );
+    pair_stripeLinks();
+    start_stripeLinkReceivers();
+
+    //. faccio partire il thread che riceve i pacchetti della sessione ( messaggi, file, cambi di chiave, chiusura )
     DWORD threadID;
-    HANDLE threadHandle = CreateThread( NULL , 0 , checkout_connection , (void*) nicHandle , 0 , &threadID );
+    HANDLE threadHandle = CreateThread( NULL , 0 , receive_sessionPackets , (void*) nicHandle , 0 , &threadID );
     if ( threadHandle == NULL ) {
         fprintf( stderr , "Error creating the thread used to maintain the connection. Restart the program.\n" );
         Sleep(10000); // 10 secondi
         exit(1);
     }
 
-    printf("---\n"); // separazione tra la fase di connessione e la fase di chat
+    //. da qui in poi la chiusura viene comunicata all'interlocutore, che viene controllato con i ping
+    sessionHandle = nicHandle;
+    start_keepalive( nicHandle );
 
-    //. esecuzione della chat
-    if ( isMaster )
-        while (1) {
+    printf("---\nType /send <path> to send a file, /stats to see the send queues, PgUp/PgDn to scroll the messages.\n"); // separazione tra la fase di connessione e la fase di chat
+    start_terminal();
 
-            // invio di un messaggio
-            char message[1000];
-            printf("You : ");
-            fgets( message , 1000 , stdin );
-            send_message( nicHandle , message );
-
-            // ricezione di un messaggio
-            receiveAndPrint_message( nicHandle );
-        
-        }
-    else
-        while (1) {
+    //. esecuzione della chat: i messaggi ricevuti vengono messi nel riquadro dal thread e disegnati dall'interfaccia, quindi si può scrivere in qualsiasi momento
+    while (1) {
 
-            // ricezione di un messaggio
-            receiveAndPrint_message( nicHandle );
+        char message[1000];
+        read_terminalLine( message , 1000 );
+        send_userInput( nicHandle , message );
 
-            // invio di un messaggio
-            char message[1000];
-            printf("You : ");
-            fgets( message , 1000 , stdin );
-            send_message( nicHandle , message );
-        
-        }
+    }
 
-}
\ No newline at end of file
+}